@@ -29,8 +29,17 @@ void AppConfig::LoadDefaults() {
   // app
   allow_snib_on_battery = false;
   anti_bounce = false;
+  battery_loop_delay = 20;
+  battery_nfc_interval = 100;
+  battery_voltage_check_interval = 15000;
+  battery_wifi_listen_interval = 3;
+  battery_wifi_sleep = 2;
   card_unlock_time = 5000;
   dev = false;
+  event_batch_delay = 0;
+  event_journal = false;
+  event_journal_max_bytes = 16384;
+  event_replay_interval = 500;
   events = false;
   exit_interactive_time = 0;
   exit_unlock_time = 5000;
@@ -39,6 +48,7 @@ void AppConfig::LoadDefaults() {
   led_bright = 1023;
   led_dim = 150;
   long_press_time = 1000;
+  message_sizes = false;
   nfc_1m_limit = 60;
   nfc_5s_limit = 30;
   nfc_check_interval = 10000;
@@ -46,9 +56,21 @@ void AppConfig::LoadDefaults() {
   nfc_read_data = 0;
   nfc_read_sig = false;
   nfc_reset_interval = 1000;
+  offline_first = false;
   remote_unlock_time = 86400000;
   snib_unlock_time = 1800000;
+  state_delta = false;
+  state_full_interval = 300000;
+  state_min_interval = 0;
+  token_cache_deny_ttl = 2000;
+  token_cache_grant_ttl = 5000;
+  token_confirm_timeout = 10000;
+  token_query_adaptive = false;
   token_query_timeout = 1000;
+  token_query_timeout_max = 5000;
+  token_query_timeout_min = 250;
+  tokens_index_max_bytes = 8192;
+  tokens_journal_max_bytes = 2048;
   voltage_check_interval = 5000;
   voltage_falling_threshold = 13.7;
   voltage_multiplier = 0.0146;
@@ -151,8 +173,17 @@ bool AppConfig::LoadAppJson(const char *filename) {
 
   allow_snib_on_battery = root["allow_snib_on_battery"] | false;
   anti_bounce = root["anti_bounce"] | false;
+  battery_loop_delay = root["battery_loop_delay"] | 20;
+  battery_nfc_interval = root["battery_nfc_interval"] | 100;
+  battery_voltage_check_interval = root["battery_voltage_check_interval"] | 15000;
+  battery_wifi_listen_interval = root["battery_wifi_listen_interval"] | 3;
+  battery_wifi_sleep = root["battery_wifi_sleep"] | 2;
   card_unlock_time = root["card_unlock_time"] | 5000;
   dev = root["dev"] | false;
+  event_batch_delay = root["event_batch_delay"] | 0;
+  event_journal = root["event_journal"] | false;
+  event_journal_max_bytes = root["event_journal_max_bytes"] | 16384;
+  event_replay_interval = root["event_replay_interval"] | 500;
   events = root["events"] | true;
   exit_interactive_time = root["exit_interactive_time"] | 0;
   exit_unlock_time = root["exit_unlock_time"] | 5000;
@@ -161,6 +192,7 @@ bool AppConfig::LoadAppJson(const char *filename) {
   led_bright = root["led_bright"] | 1023;
   led_dim = root["led_dim"] | 150;
   long_press_time = root["long_press_time"] | 1000;
+  message_sizes = root["message_sizes"] | false;
   nfc_1m_limit = root["nfc_1m_limit"] | 60;
   nfc_5s_limit = root["nfc_5s_limit"] | 30;
   nfc_check_interval = root["nfc_check_interval"] | 10000;
@@ -168,9 +200,21 @@ bool AppConfig::LoadAppJson(const char *filename) {
   nfc_read_data = root["nfc_read_data"] | 0;
   nfc_read_sig = root["nfc_read_sig"] | false;
   nfc_reset_interval = root["nfc_reset_interval"] | 1000;
+  offline_first = root["offline_first"] | false;
   remote_unlock_time = root["remote_unlock_time"] | 86400000;
   snib_unlock_time = root["snib_unlock_time"] | 1800000;
+  state_delta = root["state_delta"] | false;
+  state_full_interval = root["state_full_interval"] | 300000;
+  state_min_interval = root["state_min_interval"] | 0;
+  token_cache_deny_ttl = root["token_cache_deny_ttl"] | 2000;
+  token_cache_grant_ttl = root["token_cache_grant_ttl"] | 5000;
+  token_confirm_timeout = root["token_confirm_timeout"] | 10000;
+  token_query_adaptive = root["token_query_adaptive"] | false;
   token_query_timeout = root["token_query_timeout"] | 1000;
+  token_query_timeout_max = root["token_query_timeout_max"] | 5000;
+  token_query_timeout_min = root["token_query_timeout_min"] | 250;
+  tokens_index_max_bytes = root["tokens_index_max_bytes"] | 8192;
+  tokens_journal_max_bytes = root["tokens_journal_max_bytes"] | 2048;
   voltage_check_interval = root["voltage_check_interval"] | 5000;
   voltage_falling_threshold = root["voltage_falling_threshold"] | 13.7;
   voltage_multiplier = root["voltage_multiplier"] | 0.0146;
@@ -29,15 +29,27 @@ class AppConfig {
   bool allow_snib_on_battery;
   bool anti_bounce;
   bool dev;
+  bool event_journal;
   bool events;
   bool hold_exit_for_snib;
   bool invert_relay; // false=fail-secure, true=fail-safe/maglocks
+  bool message_sizes;
   bool nfc_read_counter;
   bool nfc_read_sig;
+  bool offline_first;
+  bool state_delta;
+  bool token_query_adaptive;
   float voltage_falling_threshold;
   float voltage_multiplier;
   float voltage_rising_threshold;
+  int battery_loop_delay;
+  int battery_nfc_interval;
+  int battery_voltage_check_interval;
+  int battery_wifi_listen_interval;
+  int battery_wifi_sleep;
   int card_unlock_time;
+  int event_batch_delay;
+  int event_replay_interval;
   int exit_interactive_time;
   int exit_unlock_time;
   int led_bright;
@@ -50,8 +62,18 @@ class AppConfig {
   int nfc_reset_interval;
   int remote_unlock_time;
   int snib_unlock_time;
+  int state_min_interval;
   int voltage_check_interval;
+  long event_journal_max_bytes;
+  long state_full_interval;
+  long token_cache_deny_ttl;
+  long token_cache_grant_ttl;
+  long token_confirm_timeout;
   long token_query_timeout;
+  long token_query_timeout_max;
+  long token_query_timeout_min;
+  long tokens_index_max_bytes;
+  long tokens_journal_max_bytes;
   void LoadDefaults();
   bool LoadWifiJson(const char *filename = "/wifi.json");
   bool LoadNetJson(const char *filename = "/net.json");
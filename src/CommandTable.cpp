@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "CommandTable.hpp"
+
+CommandTable::CommandTable() {
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    entries[i].name = NULL;
+  }
+}
+
+bool CommandTable::add(uint32_t hash, const char *name, command_handler_t handler) {
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    Entry &entry = entries[(hash + i) % COMMANDTABLE_SIZE];
+    if (entry.name == NULL || strcmp(entry.name, name) == 0) {
+      entry.hash = hash;
+      entry.name = name;
+      entry.handler = handler;
+      return true;
+    }
+  }
+  Serial.print("CommandTable: no room for ");
+  Serial.println(name);
+  return false;
+}
+
+bool CommandTable::dispatch(const char *name, const JsonDocument &obj) {
+  if (name == NULL) {
+    return false;
+  }
+
+  uint32_t hash = command_hash(name);
+
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    Entry &entry = entries[(hash + i) % COMMANDTABLE_SIZE];
+    if (entry.name == NULL) {
+      return false;
+    }
+    if (entry.hash == hash && strcmp(entry.name, name) == 0) {
+      entry.handler(obj);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef COMMANDTABLE_HPP
+#define COMMANDTABLE_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <type_traits>
+
+#define COMMANDTABLE_SIZE 32
+
+typedef void (*command_handler_t)(const JsonDocument &obj);
+
+// FNV-1a, usable at compile time
+constexpr uint32_t command_hash(const char *name, uint32_t hash = 2166136261u) {
+  return *name ? command_hash(name + 1, (hash ^ (uint8_t)*name) * 16777619u) : hash;
+}
+
+// Forces the hash of a literal command name to be computed by the compiler.
+#define COMMAND(name) std::integral_constant<uint32_t, command_hash(name)>::value, name
+
+// Open-addressed hash table from command name to handler. A lookup costs
+// one hash of the incoming name, normally one probe, and one strcmp to
+// rule out a collision, however many commands are registered.
+class CommandTable {
+ private:
+  struct Entry {
+    uint32_t hash;
+    const char *name;
+    command_handler_t handler;
+  };
+  Entry entries[COMMANDTABLE_SIZE];
+
+ public:
+  CommandTable();
+  bool add(uint32_t hash, const char *name, command_handler_t handler);
+  bool dispatch(const char *name, const JsonDocument &obj);
+};
+
+#endif
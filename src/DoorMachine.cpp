@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "DoorMachine.hpp"
+
+const DoorMachine::Transition DoorMachine::transitions[DoorMachine::event_count] = {
+  // set, clear
+  { DOOR_CARD, 0 },                  // card_grant
+  { 0, DOOR_CARD },                  // card_end
+  { DOOR_EXIT, 0 },                  // exit_request
+  { 0, DOOR_EXIT },                  // exit_end
+  { DOOR_SNIB, 0 },                  // snib_on
+  { 0, DOOR_SNIB },                  // snib_off
+  { DOOR_SNIB, DOOR_EXIT },          // exit_hold_snib_on
+  { 0, DOOR_SNIB | DOOR_EXIT },      // exit_hold_snib_off
+  { DOOR_REMOTE, 0 },                // remote_on
+  { 0, DOOR_REMOTE },                // remote_off
+  { 0, DOOR_CARD | DOOR_EXIT },      // door_open_anti_bounce
+};
+
+// LED for each combination of unlock reasons; led_on means "not unlocked",
+// which led() refines by power and network state
+const uint8_t DoorMachine::unlocked_led[16] = {
+  led_on,           // none
+  led_flash_fast,   // card
+  led_flash_fast,   // exit
+  led_flash_fast,   // card, exit
+  led_flash_medium, // snib
+  led_flash_fast,   // snib, card
+  led_flash_fast,   // snib, exit
+  led_flash_fast,   // snib, card, exit
+  led_flash_medium, // remote
+  led_flash_fast,   // remote, card
+  led_flash_fast,   // remote, exit
+  led_flash_fast,   // remote, card, exit
+  led_flash_medium, // remote, snib
+  led_flash_fast,   // remote, snib, card
+  led_flash_fast,   // remote, snib, exit
+  led_flash_fast,   // remote, snib, card, exit
+};
+
+// Apply an event, returning true if the set of unlock reasons changed.
+bool DoorMachine::fire(event_t event) {
+  if (event >= event_count) {
+    return false;
+  }
+  uint8_t next = (active & ~transitions[event].clear) | transitions[event].set;
+  bool changed = next != active;
+  active = next;
+  return changed;
+}
+
+uint8_t DoorMachine::get_active() {
+  return active;
+}
+
+bool DoorMachine::is_active(uint8_t reason) {
+  return (active & reason) != 0;
+}
+
+bool DoorMachine::relay() {
+  return active != 0;
+}
+
+DoorMachine::led_t DoorMachine::led(bool on_battery, bool network_up) {
+  if (active != 0) {
+    return (led_t)unlocked_led[active];
+  }
+  if (on_battery) {
+    return led_dim;
+  }
+  if (!network_up) {
+    return led_blink;
+  }
+  return led_on;
+}
@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef DOORMACHINE_HPP
+#define DOORMACHINE_HPP
+
+#include <stdint.h>
+
+// Plain C++ with no Arduino dependencies, so that it also builds on a host.
+
+#define DOOR_CARD 0x01
+#define DOOR_EXIT 0x02
+#define DOOR_SNIB 0x04
+#define DOOR_REMOTE 0x08
+
+// The door's state is the set of reasons it is unlocked. Each event maps
+// to a fixed transition that sets and clears some of those reasons, and
+// the outputs are a pure function of the result. Whether an event is
+// allowed (enables, battery, config) is decided by the caller before it
+// is fired.
+class DoorMachine {
+ public:
+  enum event_t {
+    card_grant,
+    card_end,
+    exit_request,
+    exit_end,
+    snib_on,
+    snib_off,
+    exit_hold_snib_on,
+    exit_hold_snib_off,
+    remote_on,
+    remote_off,
+    door_open_anti_bounce,
+    event_count
+  };
+  enum led_t { led_on, led_dim, led_blink, led_flash_medium, led_flash_fast };
+
+ private:
+  struct Transition {
+    uint8_t set;
+    uint8_t clear;
+  };
+  static const Transition transitions[event_count];
+  static const uint8_t unlocked_led[16];
+  uint8_t active = 0;
+
+ public:
+  bool fire(event_t event);
+  uint8_t get_active();
+  bool is_active(uint8_t reason);
+  bool relay();
+  led_t led(bool on_battery, bool network_up);
+};
+
+#endif
@@ -0,0 +1,159 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "EventJournal.hpp"
+#ifdef ESP32
+#include "SPIFFS.h"
+#endif
+
+// The file starts with EVENTJOURNAL_MAGIC. Each record is boot, seq and
+// millis (uint32 LE each), name length, name, message length, message.
+// millis only means something alongside the boot that wrote it.
+
+EventJournal::EventJournal(const char *filename) {
+  _filename = filename;
+}
+
+// Pick up anything left over from before a restart. A journal in any
+// other format is thrown away.
+void EventJournal::begin() {
+  length = 0;
+  replay_offset = 0;
+  if (SPIFFS.exists(_filename)) {
+    File file = SPIFFS.open(_filename, "r");
+    char magic[EVENTJOURNAL_MAGIC_SIZE];
+    if (file && file.read((uint8_t*)magic, sizeof(magic)) == sizeof(magic)
+        && memcmp(magic, EVENTJOURNAL_MAGIC, sizeof(magic)) == 0) {
+      length = file.size();
+      replay_offset = EVENTJOURNAL_MAGIC_SIZE;
+    }
+    if (file) {
+      file.close();
+    }
+    if (length == 0) {
+      Serial.println("EventJournal: discarding unknown journal");
+      SPIFFS.remove(_filename);
+    }
+  }
+}
+
+void EventJournal::set_max_bytes(uint32_t bytes) {
+  max_bytes = bytes;
+}
+
+void EventJournal::append(EventQueue &queue) {
+  if (queue.size() == 0) {
+    return;
+  }
+
+  File file = SPIFFS.open(_filename, "a");
+  if (!file) {
+    Serial.println("EventJournal: unable to open journal");
+  } else if (length == 0) {
+    file.write((const uint8_t*)EVENTJOURNAL_MAGIC, EVENTJOURNAL_MAGIC_SIZE);
+    length = EVENTJOURNAL_MAGIC_SIZE;
+    replay_offset = EVENTJOURNAL_MAGIC_SIZE;
+  }
+  while (queue.size() > 0) {
+    QueuedEvent &event = queue.front();
+    uint8_t name_length = strlen(event.name);
+    uint8_t message_length = strlen(event.message);
+    size_t record_length = 14 + name_length + message_length;
+    if (!file || length + record_length > max_bytes) {
+      break;
+    }
+    uint8_t header[13] = {
+      (uint8_t)event.boot, (uint8_t)(event.boot >> 8),
+      (uint8_t)(event.boot >> 16), (uint8_t)(event.boot >> 24),
+      (uint8_t)event.seq, (uint8_t)(event.seq >> 8),
+      (uint8_t)(event.seq >> 16), (uint8_t)(event.seq >> 24),
+      (uint8_t)event.time, (uint8_t)(event.time >> 8),
+      (uint8_t)(event.time >> 16), (uint8_t)(event.time >> 24),
+      name_length
+    };
+    file.write(header, sizeof(header));
+    file.write((const uint8_t*)event.name, name_length);
+    file.write(&message_length, 1);
+    file.write((const uint8_t*)event.message, message_length);
+    length += record_length;
+    queue.pop();
+  }
+  if (file) {
+    file.close();
+  }
+  // drop the rest rather than let a later, smaller event leave a gap
+  while (queue.size() > 0) {
+    dropped++;
+    queue.pop();
+  }
+}
+
+// Read up to max events from the replay position without consuming them.
+// A truncated record, e.g. from a power cut during a write, ends the
+// journal.
+uint8_t EventJournal::read(QueuedEvent *events, uint8_t max, uint32_t &next_offset) {
+  next_offset = replay_offset;
+  if (is_empty()) {
+    return 0;
+  }
+
+  File file = SPIFFS.open(_filename, "r");
+  if (!file || !file.seek(replay_offset, SeekSet)) {
+    next_offset = length;
+    return 0;
+  }
+
+  uint8_t count = 0;
+  while (count < max && next_offset < length) {
+    QueuedEvent &event = events[count];
+    uint8_t header[13];
+    uint8_t message_length;
+    if (file.read(header, sizeof(header)) != sizeof(header)
+        || header[12] >= sizeof(event.name)
+        || file.read((uint8_t*)event.name, header[12]) != header[12]
+        || file.read(&message_length, 1) != 1
+        || message_length >= sizeof(event.message)
+        || file.read((uint8_t*)event.message, message_length) != message_length) {
+      Serial.println("EventJournal: truncated record");
+      next_offset = length;
+      break;
+    }
+    event.boot = header[0] | (header[1] << 8) | ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+    event.seq = header[4] | (header[5] << 8) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+    event.time = header[8] | (header[9] << 8) | ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24);
+    event.name[header[12]] = '\0';
+    event.message[message_length] = '\0';
+    next_offset += 14 + header[12] + message_length;
+    count++;
+  }
+  file.close();
+  return count;
+}
+
+void EventJournal::advance(uint32_t offset, uint8_t count) {
+  replay_offset = offset;
+  replayed += count;
+  if (replay_offset >= length) {
+    SPIFFS.remove(_filename);
+    length = 0;
+    replay_offset = 0;
+  }
+}
+
+void EventJournal::clear() {
+  if (length > 0) {
+    SPIFFS.remove(_filename);
+  }
+  length = 0;
+  replay_offset = 0;
+}
+
+// bytes still waiting to be replayed
+uint32_t EventJournal::size() {
+  return length - replay_offset;
+}
+
+bool EventJournal::is_empty() {
+  return replay_offset >= length;
+}
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef EVENTJOURNAL_HPP
+#define EVENTJOURNAL_HPP
+
+#include <Arduino.h>
+#include <FS.h>
+#include "EventQueue.hpp"
+
+// events held in RAM this long while offline are written out to flash
+#define EVENTJOURNAL_SPILL_DELAY 10000
+#define EVENTJOURNAL_REPLAY_BATCH 4
+#define EVENTJOURNAL_MAGIC "EVJ2"
+#define EVENTJOURNAL_MAGIC_SIZE 4
+
+// Append-only file of events that could not be sent. Events are written
+// a queue at a time to keep flash writes down, and the file is removed
+// once everything in it has been replayed.
+class EventJournal {
+ private:
+  const char *_filename;
+  uint32_t length = 0;
+  uint32_t replay_offset = 0;
+  uint32_t max_bytes = 16384;
+
+ public:
+  unsigned long dropped = 0;
+  unsigned long replayed = 0;
+  EventJournal(const char *filename);
+  void begin();
+  void set_max_bytes(uint32_t bytes);
+  void append(EventQueue &queue);
+  uint8_t read(QueuedEvent *events, uint8_t max, uint32_t &next_offset);
+  void advance(uint32_t offset, uint8_t count);
+  void clear();
+  uint32_t size();
+  bool is_empty();
+};
+
+#endif
@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "EventQueue.hpp"
+
+void EventQueue::push(const char *name, const char *message) {
+  if (count == EVENTQUEUE_SIZE) {
+    pop();
+    dropped++;
+  }
+
+  QueuedEvent &event = events[(head + count) % EVENTQUEUE_SIZE];
+  event.boot = boot;
+  event.seq = next_seq++;
+  event.time = millis();
+  strncpy(event.name, name, sizeof(event.name));
+  event.name[sizeof(event.name)-1] = '\0';
+  strncpy(event.message, message, sizeof(event.message));
+  event.message[sizeof(event.message)-1] = '\0';
+  count++;
+}
+
+QueuedEvent &EventQueue::front() {
+  return events[head];
+}
+
+void EventQueue::pop() {
+  if (count > 0) {
+    head = (head + 1) % EVENTQUEUE_SIZE;
+    count--;
+  }
+}
+
+uint8_t EventQueue::size() {
+  return count;
+}
+
+bool EventQueue::is_full() {
+  return count == EVENTQUEUE_SIZE;
+}
+
+// milliseconds since the oldest queued event
+unsigned long EventQueue::age() {
+  if (count == 0) {
+    return 0;
+  }
+  return millis() - events[head].time;
+}
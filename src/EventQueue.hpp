@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef EVENTQUEUE_HPP
+#define EVENTQUEUE_HPP
+
+#include <Arduino.h>
+
+#define EVENTQUEUE_SIZE 12
+#define EVENTQUEUE_NAME_SIZE 24
+#define EVENTQUEUE_MESSAGE_SIZE 160
+
+struct QueuedEvent {
+  uint32_t boot;
+  uint32_t seq;
+  unsigned long time;
+  char name[EVENTQUEUE_NAME_SIZE];
+  char message[EVENTQUEUE_MESSAGE_SIZE];
+};
+
+// Fixed-size ring of events waiting to be sent together. If it fills up
+// the oldest event is overwritten.
+class EventQueue {
+ private:
+  QueuedEvent events[EVENTQUEUE_SIZE];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint32_t next_seq = 1;
+
+ public:
+  // identifies this run of the firmware, as seq restarts at every boot
+  uint32_t boot = 0;
+  unsigned long dropped = 0;
+  void push(const char *name, const char *message);
+  QueuedEvent &front();
+  void pop();
+  uint8_t size();
+  bool is_full();
+  unsigned long age();
+};
+
+#endif
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "LatencyHistogram.hpp"
+
+// upper bound (exclusive) of each bucket, the last bucket is open-ended
+const uint16_t LatencyHistogram::bounds[LATENCYHISTOGRAM_BUCKETS - 1] = {
+  1, 2, 3, 5, 7, 10, 15, 20, 30, 50, 70, 100, 150, 200, 300, 500, 700,
+  1000, 1500, 2000, 3000, 5000, 7000, 10000
+};
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+void LatencyHistogram::add(unsigned long ms) {
+  int i = 0;
+  while (i < LATENCYHISTOGRAM_BUCKETS - 1 && ms >= bounds[i]) {
+    i++;
+  }
+  buckets[i]++;
+  count++;
+  if (ms > max) {
+    max = ms;
+  }
+}
+
+unsigned long LatencyHistogram::percentile(uint8_t p) {
+  if (count == 0) {
+    return 0;
+  }
+  uint32_t target = ((uint64_t)count * p + 99) / 100;
+  uint32_t seen = 0;
+  for (int i=0; i<LATENCYHISTOGRAM_BUCKETS - 1; i++) {
+    seen += buckets[i];
+    if (seen >= target) {
+      return bounds[i] < max ? bounds[i] : max;
+    }
+  }
+  return max;
+}
+
+void LatencyHistogram::report(JsonObject obj) {
+  obj["count"] = count;
+  obj["p50"] = percentile(50);
+  obj["p95"] = percentile(95);
+  obj["max"] = max;
+}
+
+void LatencyHistogram::reset() {
+  memset(buckets, 0, sizeof(buckets));
+  count = 0;
+  max = 0;
+}
@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define LATENCYHISTOGRAM_BUCKETS 25
+
+// Counts millisecond durations into fixed, roughly logarithmic buckets.
+// Percentiles are reported as the upper bound of the bucket they fall in,
+// which is as good as the resolution gets without keeping samples.
+class LatencyHistogram {
+ private:
+  static const uint16_t bounds[LATENCYHISTOGRAM_BUCKETS - 1];
+  uint32_t buckets[LATENCYHISTOGRAM_BUCKETS];
+  uint32_t count = 0;
+  unsigned long max = 0;
+
+ public:
+  LatencyHistogram();
+  void add(unsigned long ms);
+  unsigned long percentile(uint8_t p);
+  void report(JsonObject obj);
+  void reset();
+};
+
+#endif
@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "LoopProfiler.hpp"
+
+LoopProfiler::LoopProfiler(const char *const *_names, uint8_t count) {
+  names = _names;
+  stage_count = count < LOOPPROFILER_MAX_STAGES ? count : LOOPPROFILER_MAX_STAGES;
+  reset();
+}
+
+// Account the cycles since start to a stage and return the end time, so
+// that consecutive stages tile exactly and share one read of the counter.
+// The profiler's own cost is counted in the stage that follows.
+uint32_t LoopProfiler::record(uint8_t stage, uint32_t start) {
+  uint32_t now = ESP.getCycleCount();
+  if (stage >= stage_count) {
+    return now;
+  }
+
+  uint32_t cycles = now - start;
+  Stage &s = stages[stage];
+  s.count++;
+  s.total += cycles;
+  if (cycles < s.min) {
+    s.min = cycles;
+  }
+  if (cycles > s.max) {
+    s.max = cycles;
+  }
+
+  uint32_t us = cycles / ESP.getCpuFreqMHz();
+  int bucket = 0;
+  while (us > 1 && bucket < LOOPPROFILER_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  s.buckets[bucket]++;
+
+  return now;
+}
+
+void LoopProfiler::report(JsonObject obj) {
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  for (int i=0; i<stage_count; i++) {
+    Stage &s = stages[i];
+    JsonObject stage = obj.createNestedObject(names[i]);
+    stage["count"] = s.count;
+    if (s.count == 0) {
+      continue;
+    }
+    stage["min_us"] = s.min / mhz;
+    stage["avg_us"] = (uint32_t)(s.total / s.count / mhz);
+    stage["max_us"] = s.max / mhz;
+    // trailing empty buckets are left off
+    int last = LOOPPROFILER_BUCKETS - 1;
+    while (last > 0 && s.buckets[last] == 0) {
+      last--;
+    }
+    JsonArray histogram = stage.createNestedArray("histogram");
+    for (int b=0; b<=last; b++) {
+      histogram.add(s.buckets[b]);
+    }
+  }
+}
+
+void LoopProfiler::reset() {
+  for (int i=0; i<LOOPPROFILER_MAX_STAGES; i++) {
+    memset(&stages[i], 0, sizeof(Stage));
+    stages[i].min = 0xFFFFFFFF;
+  }
+}
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef LOOPPROFILER_HPP
+#define LOOPPROFILER_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define LOOPPROFILER_MAX_STAGES 12
+#define LOOPPROFILER_BUCKETS 20
+
+// Time spent in each stage of loop(), measured with the CPU cycle counter.
+// Bucket i of the histogram counts stages that took [2^i, 2^(i+1))
+// microseconds, with everything from ~0.5s up in the last one.
+class LoopProfiler {
+ private:
+  struct Stage {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[LOOPPROFILER_BUCKETS];
+  };
+  const char *const *names;
+  uint8_t stage_count;
+  Stage stages[LOOPPROFILER_MAX_STAGES];
+
+ public:
+  LoopProfiler(const char *const *names, uint8_t count);
+  uint32_t record(uint8_t stage, uint32_t start);
+  void report(JsonObject obj);
+  void reset();
+};
+
+#endif
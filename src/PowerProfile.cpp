@@ -0,0 +1,79 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "PowerProfile.hpp"
+
+PowerProfile::PowerProfile() {
+  memset(profiles, 0, sizeof(profiles));
+  memset(activity, 0, sizeof(activity));
+}
+
+void PowerProfile::set_profile(bool _battery, const PowerSettings &settings) {
+  profiles[_battery ? 1 : 0] = settings;
+}
+
+void PowerProfile::select(bool _battery) {
+  account();
+  battery = _battery;
+}
+
+bool PowerProfile::on_battery() {
+  return battery;
+}
+
+const PowerSettings &PowerProfile::current() {
+  return profiles[battery ? 1 : 0];
+}
+
+// add the time since the last call to the current profile
+void PowerProfile::account() {
+  unsigned long now = millis();
+  activity[battery ? 1 : 0].time += now - since;
+  since = now;
+}
+
+bool PowerProfile::nfc_due() {
+  unsigned long interval = current().nfc_interval;
+  if (interval == 0) {
+    return true;
+  }
+  if ((long)(millis() - nfc_time) < (long)interval) {
+    return false;
+  }
+  nfc_time = millis();
+  return true;
+}
+
+// Idle for the profile's loop delay, but no longer than max_ms so that
+// nothing that is due gets held up.
+void PowerProfile::idle(unsigned long max_ms) {
+  unsigned long ms = current().loop_delay;
+  if (ms > max_ms) {
+    ms = max_ms;
+  }
+  if (ms > 0) {
+    delay(ms);
+    activity[battery ? 1 : 0].idle += ms;
+  }
+}
+
+void PowerProfile::count_loop() {
+  activity[battery ? 1 : 0].loops++;
+}
+
+void PowerProfile::report(JsonObject obj) {
+  account();
+  obj["current"] = battery ? "battery" : "mains";
+  const char *names[2] = { "mains", "battery" };
+  for (int i=0; i<2; i++) {
+    Activity &a = activity[i];
+    JsonObject profile = obj.createNestedObject(names[i]);
+    profile["time"] = a.time;
+    profile["loops"] = a.loops;
+    if (a.time > 0) {
+      profile["loop_rate"] = a.loops * 1000.0 / a.time;
+      profile["awake_pct"] = 100.0 - a.idle * 100.0 / a.time;
+    }
+  }
+}
@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef POWERPROFILE_HPP
+#define POWERPROFILE_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+struct PowerSettings {
+  unsigned long nfc_interval;  // minimum ms between nfc.loop() calls
+  unsigned long loop_delay;    // ms to idle at the end of each loop
+  int wifi_sleep;              // WiFiSleepType_t
+  int wifi_listen_interval;    // DTIM periods between wakes, 0 for every beacon
+  int voltage_interval;        // ms between voltage samples
+};
+
+// Mains and battery operating profiles, plus how busy the loop was under
+// each, as a stand-in for current draw.
+class PowerProfile {
+ private:
+  struct Activity {
+    unsigned long time;
+    unsigned long idle;
+    uint32_t loops;
+  };
+  PowerSettings profiles[2];
+  Activity activity[2];
+  bool battery = false;
+  unsigned long since = 0;
+  unsigned long nfc_time = 0;
+  void account();
+
+ public:
+  PowerProfile();
+  void set_profile(bool battery, const PowerSettings &settings);
+  void select(bool battery);
+  bool on_battery();
+  const PowerSettings &current();
+  bool nfc_due();
+  void idle(unsigned long max_ms);
+  void count_loop();
+  void report(JsonObject obj);
+};
+
+#endif
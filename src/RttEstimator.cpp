@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "RttEstimator.hpp"
+
+void RttEstimator::sample(unsigned long rtt) {
+  if (!valid) {
+    srtt = rtt;
+    rttvar = rtt / 2;
+    valid = true;
+  } else {
+    unsigned long delta = rtt > srtt ? rtt - srtt : srtt - rtt;
+    rttvar = (3 * rttvar + delta) / 4;
+    srtt = (7 * srtt + rtt) / 8;
+  }
+  backoff = 0;
+}
+
+void RttEstimator::on_timeout() {
+  // back off until an answer comes back, like TCP does after a
+  // retransmission timeout
+  if (backoff < RTTESTIMATOR_MAX_BACKOFF) {
+    backoff++;
+  }
+}
+
+unsigned long RttEstimator::get_timeout(unsigned long initial, unsigned long min, unsigned long max) {
+  unsigned long timeout = valid ? srtt + 4 * rttvar : initial;
+  timeout <<= backoff;
+  if (timeout < min) {
+    timeout = min;
+  }
+  if (timeout > max) {
+    timeout = max;
+  }
+  return timeout;
+}
+
+unsigned long RttEstimator::get_srtt() {
+  return srtt;
+}
+
+unsigned long RttEstimator::get_rttvar() {
+  return rttvar;
+}
+
+bool RttEstimator::is_valid() {
+  return valid;
+}
+
+void RttEstimator::reset() {
+  srtt = 0;
+  rttvar = 0;
+  valid = false;
+  backoff = 0;
+}
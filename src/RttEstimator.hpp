@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RTTESTIMATOR_HPP
+#define RTTESTIMATOR_HPP
+
+#include <Arduino.h>
+
+#define RTTESTIMATOR_MAX_BACKOFF 4
+
+// Smoothed round-trip time and deviation, computed the same way as the
+// TCP retransmission timer (RFC 6298), in milliseconds.
+class RttEstimator {
+ private:
+  unsigned long srtt = 0;
+  unsigned long rttvar = 0;
+  bool valid = false;
+  uint8_t backoff = 0;
+
+ public:
+  void sample(unsigned long rtt);
+  void on_timeout();
+  unsigned long get_timeout(unsigned long initial, unsigned long min, unsigned long max);
+  unsigned long get_srtt();
+  unsigned long get_rttvar();
+  bool is_valid();
+  void reset();
+};
+
+#endif
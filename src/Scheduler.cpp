@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "Scheduler.hpp"
+
+Scheduler::Scheduler() {
+  for (int i=0; i<SCHEDULER_SIZE; i++) {
+    position[i] = -1;
+  }
+}
+
+bool Scheduler::before(const Entry &a, const Entry &b) {
+  return (long)(a.when - b.when) < 0;
+}
+
+void Scheduler::swap(uint8_t a, uint8_t b) {
+  Entry tmp = heap[a];
+  heap[a] = heap[b];
+  heap[b] = tmp;
+  position[heap[a].id] = a;
+  position[heap[b].id] = b;
+}
+
+void Scheduler::sift_up(uint8_t i) {
+  while (i > 0 && before(heap[i], heap[(i - 1) / 2])) {
+    swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+void Scheduler::sift_down(uint8_t i) {
+  while (true) {
+    uint8_t smallest = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = 2 * i + 2;
+    if (left < count && before(heap[left], heap[smallest])) {
+      smallest = left;
+    }
+    if (right < count && before(heap[right], heap[smallest])) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    swap(i, smallest);
+    i = smallest;
+  }
+}
+
+void Scheduler::remove_at(uint8_t i) {
+  position[heap[i].id] = -1;
+  count--;
+  if (i == count) {
+    return;
+  }
+  heap[i] = heap[count];
+  position[heap[i].id] = i;
+  sift_down(i);
+  sift_up(i);
+}
+
+void Scheduler::set_callback(uint8_t id, scheduler_cb_t callback) {
+  if (id < SCHEDULER_SIZE) {
+    callbacks[id] = callback;
+  }
+}
+
+void Scheduler::at(uint8_t id, unsigned long when) {
+  if (id >= SCHEDULER_SIZE) {
+    return;
+  }
+  if (position[id] >= 0) {
+    uint8_t i = position[id];
+    heap[i].when = when;
+    sift_down(i);
+    sift_up(i);
+    return;
+  }
+  heap[count].when = when;
+  heap[count].id = id;
+  position[id] = count;
+  count++;
+  sift_up(count - 1);
+}
+
+void Scheduler::after(uint8_t id, unsigned long ms) {
+  at(id, millis() + ms);
+}
+
+void Scheduler::cancel(uint8_t id) {
+  if (id < SCHEDULER_SIZE && position[id] >= 0) {
+    remove_at(position[id]);
+  }
+}
+
+bool Scheduler::is_pending(uint8_t id) {
+  return id < SCHEDULER_SIZE && position[id] >= 0;
+}
+
+// milliseconds until the next deadline, 0 if one is already due
+unsigned long Scheduler::next_due() {
+  if (count == 0) {
+    return 0xFFFFFFFF;
+  }
+  long remaining = (long)(heap[0].when - millis());
+  return remaining > 0 ? remaining : 0;
+}
+
+// Run everything that is due. A callback may schedule itself again; it
+// won't run twice in one call unless its new deadline has also passed.
+void Scheduler::loop() {
+  while (count > 0 && (long)(millis() - heap[0].when) >= 0) {
+    uint8_t id = heap[0].id;
+    remove_at(0);
+    if (callbacks[id]) {
+      callbacks[id]();
+    }
+  }
+}
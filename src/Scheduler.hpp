@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <Arduino.h>
+#include <functional>
+
+#define SCHEDULER_SIZE 16
+
+typedef std::function<void()> scheduler_cb_t;
+
+// One-shot deadlines kept in a binary min-heap, run from loop(). Each
+// task id has at most one deadline; setting it again moves it.
+class Scheduler {
+ private:
+  struct Entry {
+    unsigned long when;
+    uint8_t id;
+  };
+  Entry heap[SCHEDULER_SIZE];
+  uint8_t count = 0;
+  int8_t position[SCHEDULER_SIZE];
+  scheduler_cb_t callbacks[SCHEDULER_SIZE];
+  static bool before(const Entry &a, const Entry &b);
+  void swap(uint8_t a, uint8_t b);
+  void sift_up(uint8_t i);
+  void sift_down(uint8_t i);
+  void remove_at(uint8_t i);
+
+ public:
+  Scheduler();
+  void set_callback(uint8_t id, scheduler_cb_t callback);
+  void at(uint8_t id, unsigned long when);
+  void after(uint8_t id, unsigned long ms);
+  void cancel(uint8_t id);
+  bool is_pending(uint8_t id);
+  unsigned long next_due();
+  void loop();
+};
+
+#endif
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "SystemMetrics.hpp"
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#ifdef ESP32
+#include "SPIFFS.h"
+#endif
+
+void SystemMetrics::loop() {
+  loop_count++;
+
+  // cheap enough to do every time, and catches short-lived dips
+  uint32_t heap = ESP.getFreeHeap();
+  if (heap < min_free_heap) {
+    min_free_heap = heap;
+  }
+
+  if ((long)(millis() - sample_time) >= SYSTEMMETRICS_SAMPLE_INTERVAL) {
+    sample();
+  }
+  if (!fs_sampled || (long)(millis() - fs_sample_time) >= SYSTEMMETRICS_FS_INTERVAL) {
+    sample_fs();
+  }
+}
+
+void SystemMetrics::sample() {
+  unsigned long now = millis();
+  if (sample_time > 0) {
+    loop_rate = (loop_count - sample_loops) * 1000.0 / (now - sample_time);
+  }
+  sample_time = now;
+  sample_loops = loop_count;
+
+  free_heap = ESP.getFreeHeap();
+  max_free_block = ESP.getMaxFreeBlockSize();
+  heap_fragmentation = ESP.getHeapFragmentation();
+  free_stack = ESP.getFreeContStack();
+  rssi = WiFi.isConnected() ? WiFi.RSSI() : 0;
+}
+
+void SystemMetrics::sample_fs() {
+  FSInfo fs_info;
+  if (SPIFFS.info(fs_info)) {
+    fs_used = fs_info.usedBytes;
+    fs_total = fs_info.totalBytes;
+  }
+  fs_sample_time = millis();
+  fs_sampled = true;
+}
+
+void SystemMetrics::report(JsonDocument &obj) {
+  obj["heap_free"] = free_heap;
+  obj["heap_free_min"] = min_free_heap;
+  obj["heap_max_block"] = max_free_block;
+  obj["heap_fragmentation"] = heap_fragmentation;
+  obj["stack_free_min"] = free_stack;
+  obj["loop_count"] = loop_count;
+  obj["loop_rate"] = loop_rate;
+  obj["wifi_rssi"] = rssi;
+  obj["wifi_connects"] = wifi_connects;
+  obj["wifi_disconnects"] = wifi_disconnects;
+  obj["network_connects"] = network_connects;
+  obj["network_disconnects"] = network_disconnects;
+  obj["fs_used"] = fs_used;
+  obj["fs_total"] = fs_total;
+}
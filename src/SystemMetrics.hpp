@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SYSTEMMETRICS_HPP
+#define SYSTEMMETRICS_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define SYSTEMMETRICS_SAMPLE_INTERVAL 1000
+#define SYSTEMMETRICS_FS_INTERVAL 60000
+
+// Heap, stack, loop and link health, sampled from loop() so that
+// reporting only has to copy out the latest values.
+class SystemMetrics {
+ private:
+  unsigned long sample_time = 0;
+  unsigned long fs_sample_time = 0;
+  bool fs_sampled = false;
+  uint32_t sample_loops = 0;
+  uint32_t loop_count = 0;
+  float loop_rate = 0;
+  uint32_t free_heap = 0;
+  uint32_t min_free_heap = 0xFFFFFFFF;
+  uint32_t max_free_block = 0;
+  uint8_t heap_fragmentation = 0;
+  uint32_t free_stack = 0;
+  int32_t rssi = 0;
+  size_t fs_used = 0;
+  size_t fs_total = 0;
+  void sample();
+  void sample_fs();
+
+ public:
+  unsigned long wifi_connects = 0;
+  unsigned long wifi_disconnects = 0;
+  unsigned long network_connects = 0;
+  unsigned long network_disconnects = 0;
+  void loop();
+  void report(JsonDocument &obj);
+};
+
+#endif
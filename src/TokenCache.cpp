@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "TokenCache.hpp"
+
+TokenCache::TokenCache() {
+  clear();
+}
+
+void TokenCache::set_ttl(unsigned long grant, unsigned long deny) {
+  grant_ttl = grant;
+  deny_ttl = deny;
+  clear();
+}
+
+bool TokenCache::expired(const Entry &entry) {
+  return entry.uid[0] == '\0' || (long)(millis() - entry.expires) >= 0;
+}
+
+void TokenCache::store(const char *uid, bool granted, int auth, const char *user) {
+  unsigned long ttl = granted ? grant_ttl : deny_ttl;
+
+  // reuse this UID's slot, otherwise an empty one, otherwise the one
+  // closest to expiry
+  Entry *slot = NULL;
+  for (int i=0; i<TOKENCACHE_SIZE; i++) {
+    if (strcmp(entries[i].uid, uid) == 0) {
+      slot = &entries[i];
+      break;
+    }
+    if (!slot || (!expired(*slot) && (expired(entries[i]) || (long)(entries[i].expires - slot->expires) < 0))) {
+      slot = &entries[i];
+    }
+  }
+
+  if (ttl == 0) {
+    // caching disabled for this kind of decision; forget any old one
+    if (strcmp(slot->uid, uid) == 0) {
+      slot->uid[0] = '\0';
+    }
+    return;
+  }
+
+  strncpy(slot->uid, uid, sizeof(slot->uid));
+  slot->uid[sizeof(slot->uid)-1] = '\0';
+  strncpy(slot->user, user, sizeof(slot->user));
+  slot->user[sizeof(slot->user)-1] = '\0';
+  slot->granted = granted;
+  slot->auth = auth;
+  slot->expires = millis() + ttl;
+}
+
+bool TokenCache::lookup(const char *uid, bool &granted, int &auth, const char *&user) {
+  for (int i=0; i<TOKENCACHE_SIZE; i++) {
+    if (!expired(entries[i]) && strcmp(entries[i].uid, uid) == 0) {
+      granted = entries[i].granted;
+      auth = entries[i].auth;
+      user = entries[i].user;
+      hits++;
+      return true;
+    }
+  }
+  misses++;
+  return false;
+}
+
+void TokenCache::clear() {
+  for (int i=0; i<TOKENCACHE_SIZE; i++) {
+    entries[i].uid[0] = '\0';
+  }
+}
@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TOKENCACHE_HPP
+#define TOKENCACHE_HPP
+
+#include <Arduino.h>
+
+#define TOKENCACHE_SIZE 8
+
+// Remembers recent access decisions so that a card that is held on the
+// reader or tapped again can be answered without another server lookup.
+class TokenCache {
+ private:
+  struct Entry {
+    char uid[15];
+    char user[33];
+    bool granted;
+    int auth;
+    unsigned long expires;
+  };
+  Entry entries[TOKENCACHE_SIZE];
+  unsigned long grant_ttl = 5000;
+  unsigned long deny_ttl = 2000;
+  bool expired(const Entry &entry);
+
+ public:
+  unsigned long hits = 0;
+  unsigned long misses = 0;
+  TokenCache();
+  void set_ttl(unsigned long grant, unsigned long deny);
+  void store(const char *uid, bool granted, int auth, const char *user);
+  bool lookup(const char *uid, bool &granted, int &auth, const char *&user);
+  void clear();
+};
+
+#endif
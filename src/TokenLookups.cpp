@@ -0,0 +1,131 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "TokenLookups.hpp"
+
+TokenLookups::TokenLookups() {
+  for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+    lookups[i].status = TokenLookup::idle;
+  }
+}
+
+TokenLookup *TokenLookups::begin(const char *uid, unsigned long timeout) {
+  // a free slot, otherwise the oldest one that has already timed out
+  TokenLookup *slot = NULL;
+  for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+    if (lookups[i].status == TokenLookup::idle) {
+      slot = &lookups[i];
+      break;
+    }
+    if (lookups[i].status == TokenLookup::expired
+        && (!slot || (long)(lookups[i].start - slot->start) < 0)) {
+      slot = &lookups[i];
+    }
+  }
+  if (!slot) {
+    overflows++;
+    return NULL;
+  }
+
+  slot->status = TokenLookup::pending;
+  slot->seq = next_seq++;
+  if (next_seq == 0) {
+    next_seq = 1;
+  }
+  strncpy(slot->uid, uid, sizeof(slot->uid));
+  slot->uid[sizeof(slot->uid)-1] = '\0';
+  slot->start = millis();
+  slot->deadline = slot->start + timeout;
+  slot->provisional = false;
+  return slot;
+}
+
+TokenLookup *TokenLookups::find(const char *uid) {
+  for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+    if (lookups[i].status == TokenLookup::pending && strcmp(lookups[i].uid, uid) == 0) {
+      return &lookups[i];
+    }
+  }
+  return NULL;
+}
+
+// Find the lookup a token_info reply belongs to, by sequence number if the
+// server echoed one and by UID otherwise. A reply to a lookup that has
+// already timed out is counted as late, anything else that cannot be
+// matched is counted as unmatched.
+TokenLookup *TokenLookups::match(uint32_t seq, const char *uid) {
+  TokenLookup *lookup = NULL;
+
+  if (seq != 0) {
+    for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+      if (lookups[i].status != TokenLookup::idle && lookups[i].seq == seq) {
+        lookup = &lookups[i];
+        break;
+      }
+    }
+    if (lookup && strcmp(lookup->uid, uid) != 0) {
+      unmatched++;
+      return NULL;
+    }
+  } else {
+    lookup = find(uid);
+    if (!lookup) {
+      for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+        if (lookups[i].status == TokenLookup::expired && strcmp(lookups[i].uid, uid) == 0) {
+          lookup = &lookups[i];
+          break;
+        }
+      }
+    }
+  }
+
+  if (!lookup) {
+    if (seq != 0 && (long)(next_seq - seq) > 0) {
+      // issued by us, but the slot has been reused since
+      late++;
+    } else {
+      unmatched++;
+    }
+    return NULL;
+  }
+  if (lookup->status == TokenLookup::expired) {
+    late++;
+  }
+  return lookup;
+}
+
+TokenLookup *TokenLookups::next_expired() {
+  for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+    if (lookups[i].status == TokenLookup::pending && (long)(millis() - lookups[i].deadline) >= 0) {
+      return &lookups[i];
+    }
+  }
+  return NULL;
+}
+
+// Give a lookup until timeout after it began, if that is later than the
+// deadline it has.
+void TokenLookups::extend(TokenLookup &lookup, unsigned long timeout) {
+  if ((long)(lookup.start + timeout - lookup.deadline) > 0) {
+    lookup.deadline = lookup.start + timeout;
+  }
+}
+
+void TokenLookups::expire(TokenLookup &lookup) {
+  lookup.status = TokenLookup::expired;
+}
+
+void TokenLookups::finish(TokenLookup &lookup) {
+  lookup.status = TokenLookup::idle;
+}
+
+int TokenLookups::pending() {
+  int count = 0;
+  for (int i=0; i<TOKENLOOKUPS_SIZE; i++) {
+    if (lookups[i].status == TokenLookup::pending) {
+      count++;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TOKENLOOKUPS_HPP
+#define TOKENLOOKUPS_HPP
+
+#include <Arduino.h>
+
+#define TOKENLOOKUPS_SIZE 4
+
+struct TokenLookup {
+  enum status_t { idle, pending, expired } status;
+  uint32_t seq;
+  char uid[15];
+  unsigned long start;
+  unsigned long deadline;
+  bool provisional;
+};
+
+// token_auth requests that are waiting for a token_info reply, each with
+// its own sequence number and deadline. Lookups that have timed out are
+// kept until their slot is needed so that a late reply can still be
+// recognised as such.
+class TokenLookups {
+ private:
+  TokenLookup lookups[TOKENLOOKUPS_SIZE];
+  uint32_t next_seq = 1;
+
+ public:
+  unsigned long late = 0;
+  unsigned long unmatched = 0;
+  unsigned long overflows = 0;
+  TokenLookups();
+  TokenLookup *begin(const char *uid, unsigned long timeout);
+  TokenLookup *find(const char *uid);
+  TokenLookup *match(uint32_t seq, const char *uid);
+  TokenLookup *next_expired();
+  void extend(TokenLookup &lookup, unsigned long timeout);
+  void expire(TokenLookup &lookup);
+  void finish(TokenLookup &lookup);
+  int pending();
+};
+
+#endif
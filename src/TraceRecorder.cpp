@@ -0,0 +1,206 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "TraceRecorder.hpp"
+
+const char *TraceRecorder::state_set_keys[trace_state_field_count] = {
+  "card_enable",
+  "exit_enable",
+  "snib_enable",
+  "card_active",
+  "exit_active",
+  "snib_active",
+  "remote_active",
+  "snib_renew",
+};
+
+// Start a new trace, keeping the existing ring if it is the right size.
+bool TraceRecorder::start(uint16_t size) {
+  if (size == 0 || size > TRACERECORDER_MAX_SIZE) {
+    size = TRACERECORDER_DEFAULT_SIZE;
+  }
+  if (records && capacity != size) {
+    clear();
+  }
+  if (!records) {
+    records = (TraceRecord*)malloc(size * sizeof(TraceRecord));
+    if (!records) {
+      Serial.println("TraceRecorder: out of memory");
+      return false;
+    }
+    capacity = size;
+  }
+  head = 0;
+  count = 0;
+  overwritten = 0;
+  voltage_due = true;
+  recording = true;
+  record(trace_start, NULL, 0);
+  return true;
+}
+
+// Stop recording but keep the trace so that it can still be read.
+void TraceRecorder::stop() {
+  recording = false;
+}
+
+void TraceRecorder::clear() {
+  recording = false;
+  free(records);
+  records = NULL;
+  capacity = 0;
+  head = 0;
+  count = 0;
+}
+
+bool TraceRecorder::is_recording() {
+  return recording;
+}
+
+uint16_t TraceRecorder::size() {
+  return count;
+}
+
+// Copy up to max records, starting index records after the oldest.
+uint16_t TraceRecorder::read(uint16_t index, TraceRecord *out, uint16_t max) {
+  uint16_t n = 0;
+  while (index + n < count && n < max) {
+    out[n] = records[(head + index + n) % capacity];
+    n++;
+  }
+  return n;
+}
+
+void TraceRecorder::record(uint8_t type, const void *data, uint8_t len) {
+  if (!recording) {
+    return;
+  }
+  if (count == capacity) {
+    head = (head + 1) % capacity;
+    count--;
+    overwritten++;
+  }
+  if (len > TRACERECORDER_DATA_SIZE) {
+    len = TRACERECORDER_DATA_SIZE;
+  }
+  TraceRecord &r = records[(head + count) % capacity];
+  r.time = millis();
+  r.type = type;
+  r.len = len;
+  memset(r.data, 0, sizeof(r.data));
+  if (len > 0) {
+    memcpy(r.data, data, len);
+  }
+  count++;
+}
+
+void TraceRecorder::input(trace_input_t input) {
+  record(trace_input, &input, sizeof(input));
+}
+
+void TraceRecorder::token(const uint8_t *uid, uint8_t len) {
+  record(trace_token, uid, len);
+}
+
+void TraceRecorder::command(uint32_t hash) {
+  record(trace_command, &hash, sizeof(hash));
+}
+
+// Samples arrive every few seconds and are mostly the same, so only a
+// change of at least TRACERECORDER_VOLTAGE_STEP is kept, plus the first
+// sample of a trace and the first after a power source change.
+void TraceRecorder::voltage(float voltage) {
+  if (!recording) {
+    return;
+  }
+  uint16_t centivolts = voltage > 0 ? voltage * 100 + 0.5 : 0;
+  uint16_t change = centivolts > last_centivolts ? centivolts - last_centivolts : last_centivolts - centivolts;
+  if (!voltage_due && change < TRACERECORDER_VOLTAGE_STEP) {
+    return;
+  }
+  voltage_due = false;
+  last_centivolts = centivolts;
+  record(trace_voltage, &centivolts, sizeof(centivolts));
+}
+
+void TraceRecorder::power(bool on_battery) {
+  uint8_t battery = on_battery;
+  record(trace_power, &battery, sizeof(battery));
+  voltage_due = true;
+}
+
+void TraceRecorder::token_info(uint32_t seq, uint8_t flags, uint8_t access) {
+  uint8_t data[6];
+  memcpy(data, &seq, sizeof(seq));
+  data[4] = flags;
+  data[5] = access;
+  record(trace_token_info, data, sizeof(data));
+}
+
+// Only the fields that change the door are kept, not user or uid.
+void TraceRecorder::state_set(const JsonDocument &obj) {
+  if (!recording) {
+    return;
+  }
+  uint8_t data[2] = {0, 0};
+  for (uint8_t i=0; i<trace_state_field_count; i++) {
+    if (obj.containsKey(state_set_keys[i])) {
+      data[0] |= 1 << i;
+      if (obj[state_set_keys[i]].as<bool>()) {
+        data[1] |= 1 << i;
+      }
+    }
+  }
+  record(trace_state_set, data, sizeof(data));
+}
+
+void TraceRecorder::local_grant(uint32_t seq, trace_grant_source_t source) {
+  uint8_t data[5];
+  memcpy(data, &seq, sizeof(seq));
+  data[4] = source;
+  record(trace_local_grant, data, sizeof(data));
+}
+
+// The door's state when a trace starts, so that a replay doesn't have to
+// assume it began locked. Times are rounded up to whole seconds, or to
+// whole minutes past about nine hours, which still covers a day-long
+// remote unlock.
+void TraceRecorder::snapshot(uint8_t active, uint8_t flags, const unsigned long remaining[4]) {
+  uint8_t data[10];
+  data[0] = active;
+  data[1] = flags;
+  for (int i=0; i<4; i++) {
+    unsigned long seconds = (remaining[i] + 999) / 1000;
+    uint16_t value;
+    if (seconds < TRACE_MINUTES) {
+      value = seconds;
+    } else {
+      unsigned long minutes = (seconds + 59) / 60;
+      value = TRACE_MINUTES | (minutes < TRACE_MINUTES ? minutes : TRACE_MINUTES - 1);
+    }
+    memcpy(&data[2 + i * 2], &value, sizeof(value));
+  }
+  record(trace_snapshot, data, sizeof(data));
+}
+
+// milliseconds left on an unlock, indexed as the DOOR_* bits
+unsigned long TraceRecorder::snapshot_remaining(const TraceRecord &record, uint8_t reason) {
+  uint16_t value = record.data[2 + reason * 2] | (record.data[3 + reason * 2] << 8);
+  if (value & TRACE_MINUTES) {
+    return (value & ~TRACE_MINUTES) * 60000UL;
+  }
+  return value * 1000UL;
+}
+
+// ties a token record to the lookup that the token_info records refer to
+void TraceRecorder::token_auth(uint32_t seq) {
+  record(trace_token_auth, &seq, sizeof(seq));
+}
+
+void TraceRecorder::report(JsonObject obj) {
+  obj["recording"] = recording;
+  obj["capacity"] = capacity;
+  obj["records"] = count;
+  obj["overwritten"] = overwritten;
+}
@@ -0,0 +1,132 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TRACERECORDER_HPP
+#define TRACERECORDER_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define TRACERECORDER_DEFAULT_SIZE 256
+#define TRACERECORDER_MAX_SIZE 512
+#define TRACERECORDER_DATA_SIZE 10
+#define TRACERECORDER_QUERY_BATCH 16
+// smallest voltage change worth a record, in centivolts
+#define TRACERECORDER_VOLTAGE_STEP 10
+
+enum trace_type_t : uint8_t {
+  trace_start = 0,
+  trace_input = 1,
+  trace_token = 2,
+  trace_command = 3,
+  trace_voltage = 4,
+  trace_power = 5,
+  trace_token_info = 6,
+  trace_state_set = 7,
+  trace_local_grant = 8,
+  trace_snapshot = 9,
+  trace_token_auth = 10,
+};
+
+enum trace_input_t : uint8_t {
+  trace_door_open,
+  trace_door_close,
+  trace_exit_press,
+  trace_exit_longpress,
+  trace_exit_release,
+  trace_snib_press,
+  trace_snib_longpress,
+  trace_snib_release,
+};
+
+// token_info flags
+#define TRACE_FOUND 0x01
+#define TRACE_TIMEOUT 0x02
+#define TRACE_LATE 0x04
+#define TRACE_PROVISIONAL 0x08
+
+// state_set fields, in the order of TraceRecorder::state_set_keys
+enum trace_state_field_t : uint8_t {
+  trace_card_enable,
+  trace_exit_enable,
+  trace_snib_enable,
+  trace_card_active,
+  trace_exit_active,
+  trace_snib_active,
+  trace_remote_active,
+  trace_snib_renew,
+  trace_state_field_count
+};
+
+// snapshot flags; the enables use the state_set bits
+#define TRACE_ON_BATTERY 0x80
+// a snapshot time with this bit set is in minutes, not seconds
+#define TRACE_MINUTES 0x8000
+
+// where a card let in without the server's say-so was decided
+enum trace_grant_source_t : uint8_t {
+  trace_cached,
+  trace_database,
+};
+
+// 16 bytes, little-endian as stored on the ESP8266:
+//   start:   no data
+//   input:   trace_input_t
+//   token:   UID bytes
+//   command: command_hash() of the name, uint32
+//   voltage: centivolts, uint16
+//   power:   1 on battery, 0 on mains
+//   token_info: lookup seq uint32, TRACE_* flags, access
+//   state_set: bitmask of fields present, bitmask of those set true
+//   local_grant: lookup seq uint32 (0 if none), trace_grant_source_t
+//   snapshot: DOOR_* mask, flags, then the time left on the card, exit,
+//             snib and remote unlocks, uint16 each, in seconds or with
+//             TRACE_MINUTES set in minutes
+//   token_auth: lookup seq uint32
+struct TraceRecord {
+  uint32_t time;
+  uint8_t type;
+  uint8_t len;
+  uint8_t data[TRACERECORDER_DATA_SIZE];
+};
+
+// Records what happened to the door, and when, into a RAM ring so that a
+// sequence can be pulled off a real device and fed back through the logic
+// elsewhere. The ring is only allocated while a trace is wanted, and when
+// it is full the oldest records are overwritten.
+class TraceRecorder {
+ private:
+  TraceRecord *records = NULL;
+  uint16_t capacity = 0;
+  uint16_t head = 0;
+  uint16_t count = 0;
+  bool recording = false;
+  bool voltage_due = true;
+  uint16_t last_centivolts = 0;
+  void record(uint8_t type, const void *data, uint8_t len);
+
+ public:
+  static const char *state_set_keys[trace_state_field_count];
+  unsigned long overwritten = 0;
+  bool start(uint16_t size);
+  void stop();
+  void clear();
+  bool is_recording();
+  uint16_t size();
+  uint16_t read(uint16_t index, TraceRecord *out, uint16_t max);
+  void input(trace_input_t input);
+  void token(const uint8_t *uid, uint8_t len);
+  void command(uint32_t hash);
+  void voltage(float voltage);
+  void power(bool on_battery);
+  void token_info(uint32_t seq, uint8_t flags, uint8_t access);
+  void state_set(const JsonDocument &obj);
+  void local_grant(uint32_t seq, trace_grant_source_t source);
+  void snapshot(uint8_t active, uint8_t flags, const unsigned long remaining[4]);
+  static unsigned long snapshot_remaining(const TraceRecord &record, uint8_t reason);
+  void token_auth(uint32_t seq);
+  void report(JsonObject obj);
+};
+
+#endif
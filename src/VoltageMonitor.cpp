@@ -1,4 +1,4 @@
-// SPDX-FileCopyrightText: 2019 Tim Hawes
+// SPDX-FileCopyrightText: 2019-2024 Tim Hawes
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 
@@ -8,17 +8,19 @@ VoltageMonitor::VoltageMonitor() {
 
 }
 
-void VoltageMonitor::begin() {
-  ticker.detach();
-  ticker_callback();
-  ticker.attach_ms(interval, std::bind(&VoltageMonitor::ticker_callback, this));
+void VoltageMonitor::begin(Scheduler &_scheduler, uint8_t _task_id) {
+  scheduler = &_scheduler;
+  task_id = _task_id;
+  scheduler->set_callback(task_id, std::bind(&VoltageMonitor::sample, this));
+  sample();
 }
 
 void VoltageMonitor::set_interval(int _interval) {
   if (interval != _interval) {
     interval = _interval;
-    ticker.detach();
-    ticker.attach_ms(interval, std::bind(&VoltageMonitor::ticker_callback, this));
+    if (scheduler) {
+      scheduler->after(task_id, interval);
+    }
   }
 }
 
@@ -31,7 +33,8 @@ void VoltageMonitor::set_threshold(float battery, float mains) {
   mains_threshold = mains;
 }
 
-void VoltageMonitor::ticker_callback() {
+void VoltageMonitor::sample() {
+  scheduler->after(task_id, interval);
   voltage = analogRead(A0) * adc_to_volts;
   if (voltage_callback) {
     voltage_callback(voltage);
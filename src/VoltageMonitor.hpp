@@ -1,4 +1,4 @@
-// SPDX-FileCopyrightText: 2019 Tim Hawes
+// SPDX-FileCopyrightText: 2019-2024 Tim Hawes
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 
@@ -6,7 +6,7 @@
 #define VOLTAGEMONITOR_HPP
 
 #include <Arduino.h>
-#include <Ticker.h>
+#include "Scheduler.hpp"
 
 typedef void (*voltagemonitor_voltage_cb_t)(float voltage);
 typedef void (*voltagemonitor_cb_t)();
@@ -20,15 +20,16 @@ class VoltageMonitor {
   int interval = 5000;
   bool on_battery = false;
   bool first_run = true;
-  Ticker ticker;
-  void ticker_callback();
+  Scheduler *scheduler = NULL;
+  uint8_t task_id;
+  void sample();
 
  public:
   voltagemonitor_cb_t on_battery_callback = NULL;
   voltagemonitor_cb_t on_mains_callback = NULL;
   voltagemonitor_voltage_cb_t voltage_callback = NULL;
   VoltageMonitor();
-  void begin();
+  void begin(Scheduler &scheduler, uint8_t task_id);
   void set_interval(int interval);
   void set_ratio(float ratio);
   void set_threshold(float battery, float mains);
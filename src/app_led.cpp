@@ -1,4 +1,4 @@
-// SPDX-FileCopyrightText: 2019-2023 Tim Hawes
+// SPDX-FileCopyrightText: 2019-2024 Tim Hawes
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 
@@ -6,25 +6,46 @@
 
 Led::Led(int _led_pin) {
   led_pin = _led_pin;
-  ticker.attach_ms(5, std::bind(&Led::callback, this));
 }
 
 void Led::callback() {
-  if (pending_change && (long)(millis() - next_change) >= 0) {
-    if (is_on) {
-      is_on = !is_on;
-      analogWrite(led_pin, 0);
-      next_change = millis() + off_time;
-    } else {
-      is_on = !is_on;
-      analogWrite(led_pin, bright_level);
-      next_change = millis() + on_time;
-    }
+  if (!pending_change) {
+    return;
+  }
+  if (is_on) {
+    is_on = !is_on;
+    analogWrite(led_pin, 0);
+    scheduler->after(task_id, off_time);
+  } else {
+    is_on = !is_on;
+    analogWrite(led_pin, bright_level);
+    scheduler->after(task_id, on_time);
   }
 }
 
-void Led::begin() {
+void Led::begin(Scheduler &_scheduler, uint8_t _task_id) {
+  scheduler = &_scheduler;
+  task_id = _task_id;
+  scheduler->set_callback(task_id, std::bind(&Led::callback, this));
   pinMode(led_pin, OUTPUT);
+  if (pending_change) {
+    scheduler->at(task_id, millis());
+  }
+}
+
+// flashing is driven by the scheduler once begin() has been called
+void Led::start() {
+  pending_change = true;
+  if (scheduler) {
+    scheduler->at(task_id, millis());
+  }
+}
+
+void Led::stop() {
+  pending_change = false;
+  if (scheduler) {
+    scheduler->cancel(task_id);
+  }
 }
 
 void Led::on() {
@@ -32,7 +53,7 @@ void Led::on() {
     return;
   }
   mode = MODE_ON;
-  pending_change = false;
+  stop();
   analogWrite(led_pin, bright_level);
   is_on = true;
 }
@@ -42,7 +63,7 @@ void Led::off() {
     return;
   }
   mode = MODE_OFF;
-  pending_change = false;
+  stop();
   analogWrite(led_pin, 0);
   is_on = false;
 }
@@ -54,8 +75,7 @@ void Led::flash_fast() {
   mode = MODE_FAST;
   on_time = 40;
   off_time = 40;
-  next_change = millis();
-  pending_change = true;
+  start();
 }
 
 void Led::flash_medium() {
@@ -65,8 +85,7 @@ void Led::flash_medium() {
   mode = MODE_MEDIUM;
   on_time = 500;
   off_time = 500;
-  next_change = millis();
-  pending_change = true;
+  start();
 }
 
 void Led::flash_slow() {
@@ -76,8 +95,7 @@ void Led::flash_slow() {
   mode = MODE_SLOW;
   on_time = 1000;
   off_time = 1000;
-  next_change = millis();
-  pending_change = true;
+  start();
 }
 
 void Led::blink() {
@@ -87,8 +105,7 @@ void Led::blink() {
   mode = MODE_BLINK;
   on_time = 25;
   off_time = 1225;
-  next_change = millis();
-  pending_change = true;
+  start();
 }
 
 void Led::dim() {
@@ -96,7 +113,7 @@ void Led::dim() {
     return;
   }
   mode = MODE_DIM;
-  pending_change = false;
+  stop();
   analogWrite(led_pin, dim_level);
 }
 
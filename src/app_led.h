@@ -1,4 +1,4 @@
-// SPDX-FileCopyrightText: 2019-2023 Tim Hawes
+// SPDX-FileCopyrightText: 2019-2024 Tim Hawes
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 
@@ -6,14 +6,14 @@
 #define APP_LED_H
 
 #include <Arduino.h>
-#include <Ticker.h>
+#include "Scheduler.hpp"
 
 class Led
 {
 private:
-  Ticker ticker;
+  Scheduler *scheduler = NULL;
+  uint8_t task_id;
   enum { MODE_OFF, MODE_DIM, MODE_BLINK, MODE_SLOW, MODE_MEDIUM, MODE_FAST, MODE_ON } mode = MODE_OFF;
-  unsigned long next_change;
   bool pending_change = false;
   int led_pin;
   int dim_level = 150;
@@ -22,10 +22,12 @@ private:
   long off_time;
   bool is_on;
   void callback();
+  void start();
+  void stop();
 
 public:
   Led(int led_pin);
-  void begin();
+  void begin(Scheduler &scheduler, uint8_t task_id);
   void blink();
   void flash_fast();
   void flash_medium();
@@ -37,16 +37,17 @@ int decode_hex(const char *hexstr, uint8_t *bytes, size_t max_len)
   return bytelen;
 }
 
-String hexlify(uint8_t bytes[], uint8_t len)
+// Write len bytes as lowercase hex into out, which must have room for
+// len*2+1 characters.
+char *hexlify(const uint8_t *bytes, size_t len, char *out)
 {
-  String output;
-  output.reserve(len*2);
-  for (int i=0; i<len; i++) {
-    char hex[3];
-    sprintf(hex, "%02x", bytes[i]);
-    output.concat(hex);
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i=0; i<len; i++) {
+    out[i*2] = digits[bytes[i] >> 4];
+    out[i*2+1] = digits[bytes[i] & 0x0f];
   }
-  return output;
+  out[len*2] = '\0';
+  return out;
 }
 
 void i2c_scan()
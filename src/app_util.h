@@ -8,7 +8,7 @@
 #include <Arduino.h>
 
 int decode_hex(const char *hexstr, uint8_t *bytes, size_t max_len);
-String hexlify(uint8_t bytes[], uint8_t len);
+char *hexlify(const uint8_t *bytes, size_t len, char *out);
 void i2c_scan();
 void fix_filenames();
 
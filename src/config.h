@@ -9,5 +9,7 @@ const char *setup_password = "password";
 #define NET_JSON_FILENAME "/net.json"
 #define WIFI_JSON_FILENAME "/wifi.json"
 #define TOKENS_FILENAME "/tokens.dat"
+#define TOKENS_JOURNAL_FILENAME "/tokens.jnl"
+#define EVENTS_JOURNAL_FILENAME "/events.jnl"
 
 #endif
@@ -12,7 +12,20 @@
 #include <base64.hpp>
 
 #include "AppConfig.hpp"
+#include "CommandTable.hpp"
+#include "DoorMachine.hpp"
+#include "EventJournal.hpp"
+#include "EventQueue.hpp"
+#include "LatencyHistogram.hpp"
+#include "LoopProfiler.hpp"
+#include "PowerProfile.hpp"
 #include "Relay.hpp"
+#include "RttEstimator.hpp"
+#include "Scheduler.hpp"
+#include "SystemMetrics.hpp"
+#include "TokenCache.hpp"
+#include "TokenLookups.hpp"
+#include "TraceRecorder.hpp"
 #include "VoltageMonitor.hpp"
 #include "app_inputs.h"
 #include "app_led.h"
@@ -45,9 +58,67 @@ Inputs inputs(door_pin, exit_pin, snib_pin);
 VoltageMonitor voltagemonitor;
 Led led(led_pin);
 Relay relay(relay_pin);
-
-char pending_token[15];
-unsigned long pending_token_time = 0;
+TokenDB tokendb(TOKENS_FILENAME, TOKENS_JOURNAL_FILENAME);
+TokenCache tokencache;
+
+TokenLookups token_lookups;
+CommandTable commands;
+Scheduler scheduler;
+PowerProfile powerprofile;
+TraceRecorder trace;
+
+enum task_t {
+  task_card_expiry, task_exit_expiry, task_snib_expiry, task_remote_expiry,
+  task_led, task_voltage
+};
+SystemMetrics systemmetrics;
+
+#ifdef LOOP_PROFILER
+enum profile_stage_t {
+  profile_metrics, profile_nfc, profile_inputs, profile_net, profile_scheduler,
+  profile_lookups, profile_state, profile_publish, profile_events, profile_tokendb
+};
+const char *const profile_stage_names[] = {
+  "metrics", "nfc", "inputs", "net", "scheduler",
+  "lookups", "state", "publish", "events", "tokendb"
+};
+LoopProfiler loopprofiler(profile_stage_names, sizeof(profile_stage_names) / sizeof(profile_stage_names[0]));
+#define PROFILE_BEGIN() uint32_t profile_time = ESP.getCycleCount()
+#define PROFILE(stage) profile_time = loopprofiler.record(stage, profile_time)
+#else
+#define PROFILE_BEGIN()
+#define PROFILE(stage)
+#endif
+// Shared by the messages built in the main loop so that sending them
+// doesn't touch the heap. Strings are added as const char* wherever the
+// source outlives the send, so that they aren't copied into the pool.
+StaticJsonDocument<2048> json_doc;
+// room for every binary field of an NFCToken as hex, with terminators
+char token_hex[(sizeof(NFCToken::ats) + sizeof(NFCToken::version) +
+                sizeof(NFCToken::ntag_signature) + sizeof(NFCToken::data)) * 2 + 4];
+unsigned long token_hex_overflows = 0;
+
+EventQueue eventqueue;
+EventJournal eventjournal(EVENTS_JOURNAL_FILENAME);
+QueuedEvent replay_batch[EVENTJOURNAL_REPLAY_BATCH];
+unsigned long event_replay_time = 0;
+
+LatencyHistogram latency_nfc_read;
+LatencyHistogram latency_token_present;
+LatencyHistogram latency_server_reply;
+LatencyHistogram latency_db_lookup;
+LatencyHistogram latency_unlock_online;
+LatencyHistogram latency_unlock_offline;
+LatencyHistogram latency_unlock_fallback;
+LatencyHistogram latency_unlock_cached;
+LatencyHistogram *unlock_latency = NULL;
+unsigned long unlock_latency_start = 0;
+unsigned long token_query_timeouts = 0;
+RttEstimator token_query_rtt;
+
+unsigned long message_count = 0;
+unsigned long message_json_bytes = 0;
+unsigned long message_msgpack_bytes = 0;
 
 bool firmware_restart_pending = false;
 bool restart_pending = false;
@@ -73,230 +144,662 @@ struct State {
   bool network_up = false;
   char user[33] = "";
   char uid[15] = "";
-  enum { auth_none, auth_online, auth_offline } auth;
+  enum auth_t { auth_none, auth_online, auth_offline } auth;
 } state;
 
+DoorMachine door;
+
+// The *_active fields mirror the door machine, which owns them.
+void door_event(DoorMachine::event_t event)
+{
+  if (door.fire(event)) {
+    state.card_active = door.is_active(DOOR_CARD);
+    state.exit_active = door.is_active(DOOR_EXIT);
+    state.snib_active = door.is_active(DOOR_SNIB);
+    state.remote_active = door.is_active(DOOR_REMOTE);
+    state.changed = true;
+  }
+}
+
+State state_sent;
+bool state_sent_valid = false;
+uint32_t state_version = 0;
+unsigned long state_full_time = 0;
+bool state_publish_pending = false;
+unsigned long state_publish_time = 0;
+unsigned long state_info_sent = 0;
+unsigned long state_info_suppressed = 0;
+
 WiFiEventHandler wifiEventConnectHandler;
 WiFiEventHandler wifiEventDisconnectHandler;
 bool wifi_connected = false;
 bool network_connected = false;
 
-Ticker token_lookup_timer;
-
 bool status_updated = false;
 
 buzzer_note network_tune[128];
 buzzer_note ascending[] = { {1000, 250}, {1500, 250}, {2000, 250}, {0, 0} };
 
-void send_state()
+// Every message to the server goes out through here, so that a binary
+// encoding can be switched on in one place once NetThing can carry one.
+// Until then, message_sizes tallies what each message would come to as
+// MessagePack alongside its JSON size, for metrics_query.
+bool send_message(const JsonDocument &obj, bool wait = false)
 {
-  DynamicJsonDocument obj(1024);
-  obj["cmd"] = "state_info";
-  obj["card_enable"] = state.card_enable;
-  obj["card_active"] = state.card_active;
-  obj["card_unlock_until"] = state.card_unlock_until;
-  obj["exit_enable"] = state.exit_enable;
-  obj["exit_active"] = state.exit_active;
-  obj["exit_unlock_until"] = state.exit_unlock_until;
-  obj["snib_enable"] = state.snib_enable;
-  obj["snib_active"] = state.snib_active;
-  obj["snib_unlock_until"] = state.snib_unlock_until;
-  obj["remote_active"] = state.remote_active;
-  obj["remote_unlock_until"] = state.remote_unlock_until;
-  obj["unlock"] = state.unlock_active;
-  obj["voltage"] = state.voltage;
-  obj["user"] = state.user;
-  obj["uid"] = state.uid;
-  switch (state.auth) {
-    case state.auth_none:
-      obj["auth"] = (char*)0;
-      break;
-    case state.auth_online:
-      obj["auth"] = "online";
-      break;
-    case state.auth_offline:
-      obj["auth"] = "offline";
-      break;
-  }
-  if (state.door_open) {
-    obj["door"] = "open";
-  } else {
-    obj["door"] = "closed";
+  if (config.message_sizes) {
+    message_count++;
+    message_json_bytes += measureJson(obj);
+    message_msgpack_bytes += measureMsgPack(obj);
   }
-  if (state.on_battery) {
-    obj["power"] = "battery";
-  } else {
-    obj["power"] = "mains";
+  return net.sendJson(obj, wait);
+}
+
+void add_event(JsonArray events, const QueuedEvent &event)
+{
+  JsonObject item = events.createNestedObject();
+  item["boot"] = event.boot;
+  item["seq"] = event.seq;
+  item["millis"] = event.time;
+  // journalled events from an earlier boot have no age that can be known
+  if (event.boot == eventqueue.boot) {
+    item["age"] = millis() - event.time;
+  }
+  item["event"] = (const char*)event.name;
+  if (event.message[0] != '\0') {
+    item["message"] = (const char*)event.message;
+  }
+}
+
+void flush_events()
+{
+  if (eventqueue.size() == 0) {
+    return;
+  }
+
+  json_doc.clear();
+  json_doc["cmd"] = "event_batch";
+  json_doc["boot"] = eventqueue.boot;
+  json_doc["millis"] = millis();
+  JsonArray events = json_doc.createNestedArray("events");
+  while (eventqueue.size() > 0) {
+    add_event(events, eventqueue.front());
+    eventqueue.pop();
+  }
+  send_message(json_doc);
+}
+
+// Send the queue if the server is reachable and nothing older is waiting
+// in the journal, otherwise keep it for later. Without event_journal the
+// queue just stays in RAM while offline, overwriting its oldest events.
+void drain_events()
+{
+  if (network_connected && eventjournal.is_empty()) {
+    flush_events();
+  } else if (config.event_journal) {
+    eventjournal.append(eventqueue);
+  }
+}
+
+// Whether an event can skip the queue and go out as a plain event, as it
+// always did before batching and journalling.
+bool send_event_direct()
+{
+  if (config.event_batch_delay > 0) {
+    return false;
+  }
+  if (!config.event_journal) {
+    return true;
+  }
+  return network_connected && eventjournal.is_empty() && eventqueue.size() == 0;
+}
+
+// Send a few journalled events at a time, giving way to card lookups.
+void replay_events()
+{
+  if (!config.event_journal || !network_connected || eventjournal.is_empty()
+      || token_lookups.pending() > 0) {
+    return;
   }
-  obj.shrinkToFit();
-  net.sendJson(obj);
+  if ((long)(millis() - event_replay_time) < config.event_replay_interval) {
+    return;
+  }
+  event_replay_time = millis();
+
+  uint32_t next_offset;
+  uint8_t count = eventjournal.read(replay_batch, EVENTJOURNAL_REPLAY_BATCH, next_offset);
+  if (count > 0) {
+    json_doc.clear();
+    json_doc["cmd"] = "event_batch";
+    json_doc["boot"] = eventqueue.boot;
+    json_doc["millis"] = millis();
+    json_doc["replay"] = true;
+    JsonArray events = json_doc.createNestedArray("events");
+    for (int i=0; i<count; i++) {
+      add_event(events, replay_batch[i]);
+    }
+    if (!send_message(json_doc)) {
+      return;
+    }
+  }
+  eventjournal.advance(next_offset, count);
+}
+
+// Events are sent straight away unless event_batch_delay is set, in which
+// case they are queued and sent together once the oldest has waited that
+// long or the queue is full. With event_journal set, events are also
+// queued while offline and journalled to flash, to be replayed as
+// event_batch after reconnecting.
+void send_event(const char *event)
+{
+  if (send_event_direct()) {
+    net.sendEvent(event);
+    return;
+  }
+  if (eventqueue.is_full()) {
+    drain_events();
+  }
+  eventqueue.push(event, "");
+}
+
+void send_event(const char *event, size_t size, const char *format, ...)
+{
+  char message[size];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, size, format, args);
+  va_end(args);
+
+  if (send_event_direct()) {
+    net.sendEvent(event, size, "%s", message);
+    return;
+  }
+  if (eventqueue.is_full()) {
+    drain_events();
+  }
+  eventqueue.push(event, message);
+}
+
+template <typename T>
+void add_state_field(JsonDocument &obj, const char *key, const T &value, const T &sent, bool delta)
+{
+  if (!delta || value != sent) {
+    obj[key] = value;
+  }
+}
+
+void add_state_string(JsonDocument &obj, const char *key, const char *value, const char *sent, bool delta)
+{
+  if (!delta || strcmp(value, sent) != 0) {
+    obj[key] = value;
+  }
+}
+
+const char *state_auth_name(State::auth_t auth)
+{
+  switch (auth) {
+    case State::auth_online:
+      return "online";
+    case State::auth_offline:
+      return "offline";
+    default:
+      return NULL;
+  }
+}
+
+// With state_delta enabled, only the fields that differ from the last
+// state_info are sent, along with a version number so that the server can
+// spot a missed message and ask for a full snapshot with state_query.
+void send_state(bool full = false)
+{
+  bool delta = config.state_delta && !full && state_sent_valid;
+
+  JsonDocument &obj = json_doc;
+  obj.clear();
+  obj["cmd"] = "state_info";
+  add_state_field(obj, "card_enable", state.card_enable, state_sent.card_enable, delta);
+  add_state_field(obj, "card_active", state.card_active, state_sent.card_active, delta);
+  add_state_field(obj, "card_unlock_until", state.card_unlock_until, state_sent.card_unlock_until, delta);
+  add_state_field(obj, "exit_enable", state.exit_enable, state_sent.exit_enable, delta);
+  add_state_field(obj, "exit_active", state.exit_active, state_sent.exit_active, delta);
+  add_state_field(obj, "exit_unlock_until", state.exit_unlock_until, state_sent.exit_unlock_until, delta);
+  add_state_field(obj, "snib_enable", state.snib_enable, state_sent.snib_enable, delta);
+  add_state_field(obj, "snib_active", state.snib_active, state_sent.snib_active, delta);
+  add_state_field(obj, "snib_unlock_until", state.snib_unlock_until, state_sent.snib_unlock_until, delta);
+  add_state_field(obj, "remote_active", state.remote_active, state_sent.remote_active, delta);
+  add_state_field(obj, "remote_unlock_until", state.remote_unlock_until, state_sent.remote_unlock_until, delta);
+  add_state_field(obj, "unlock", state.unlock_active, state_sent.unlock_active, delta);
+  add_state_field(obj, "voltage", state.voltage, state_sent.voltage, delta);
+  add_state_string(obj, "user", state.user, state_sent.user, delta);
+  add_state_string(obj, "uid", state.uid, state_sent.uid, delta);
+  if (!delta || state.auth != state_sent.auth) {
+    obj["auth"] = state_auth_name(state.auth);
+  }
+  add_state_string(obj, "door", state.door_open ? "open" : "closed", state_sent.door_open ? "open" : "closed", delta);
+  add_state_string(obj, "power", state.on_battery ? "battery" : "mains", state_sent.on_battery ? "battery" : "mains", delta);
 
   status_updated = false;
+  state_publish_pending = false;
+  state_publish_time = millis();
+
+  if (delta && obj.size() == 1) {
+    // nothing the server sees has changed
+    return;
+  }
+
+  obj["version"] = ++state_version;
+  obj["full"] = !delta;
+  send_message(obj);
+  state_info_sent++;
+
+  state_sent = state;
+  state_sent_valid = true;
+  if (!delta) {
+    state_full_time = millis();
+  }
 }
 
 void check_leds()
 {
-  if (state.card_active || state.exit_active) {
+  switch (door.led(state.on_battery, state.network_up)) {
+  case DoorMachine::led_flash_fast:
     led.flash_fast();
-  } else if (state.snib_active || state.remote_active) {
+    break;
+  case DoorMachine::led_flash_medium:
     led.flash_medium();
-  } else if (state.on_battery) {
+    break;
+  case DoorMachine::led_dim:
     led.dim();
-  } else if (state.network_up == false) {
+    break;
+  case DoorMachine::led_blink:
     led.blink();
-  } else {
+    break;
+  default:
     led.on();
   }
 }
 
-void handle_timeouts()
+// An unlock can be extended after its expiry was last scheduled, e.g. by
+// a second exit press in the same loop pass, so check the deadline again
+// and push the task back if it has moved.
+bool unlock_extended(uint8_t task_id, unsigned long until)
 {
-  if (state.card_active && (long)(millis() - state.card_unlock_until) > 0) {
+  if ((long)(until - millis()) > 0) {
+    scheduler.at(task_id, until);
+    return true;
+  }
+  return false;
+}
+
+void card_unlock_expired()
+{
+  if (state.card_active && !unlock_extended(task_card_expiry, state.card_unlock_until)) {
     Serial.println("card unlock expired");
-    state.card_active = false;
+    door_event(DoorMachine::card_end);
     state.auth = state.auth_none;
     strncpy(state.user, "", sizeof(state.user));
     strncpy(state.uid, "", sizeof(state.uid));
     state.changed = true;
   }
-  if (state.exit_active && (long)(millis() - state.exit_unlock_until) > 0) {
+}
+
+void exit_unlock_expired()
+{
+  if (state.exit_active && !unlock_extended(task_exit_expiry, state.exit_unlock_until)) {
     Serial.println("exit unlock expired");
-    state.exit_active = false;
-    state.changed = true;
+    door_event(DoorMachine::exit_end);
   }
-  if (state.snib_active && (long)(millis() - state.snib_unlock_until) > 0) {
+}
+
+void snib_unlock_expired()
+{
+  if (state.snib_active && !unlock_extended(task_snib_expiry, state.snib_unlock_until)) {
     Serial.println("snib unlock expired");
-    state.snib_active = false;
-    state.changed = true;
+    door_event(DoorMachine::snib_off);
   }
-  if (state.remote_active && (long)(millis() - state.remote_unlock_until) > 0) {
+}
+
+void remote_unlock_expired()
+{
+  if (state.remote_active && !unlock_extended(task_remote_expiry, state.remote_unlock_until)) {
     Serial.println("remote unlock expired");
-    state.remote_active = false;
-    state.changed = true;
+    door_event(DoorMachine::remote_off);
+  }
+}
+
+// Keep the scheduler's expiry deadlines in line with the *_unlock_until
+// fields, after anything might have changed them.
+void schedule_unlock_expiries()
+{
+  if (state.card_active) {
+    scheduler.at(task_card_expiry, state.card_unlock_until);
+  } else {
+    scheduler.cancel(task_card_expiry);
+  }
+  if (state.exit_active) {
+    scheduler.at(task_exit_expiry, state.exit_unlock_until);
+  } else {
+    scheduler.cancel(task_exit_expiry);
+  }
+  if (state.snib_active) {
+    scheduler.at(task_snib_expiry, state.snib_unlock_until);
+  } else {
+    scheduler.cancel(task_snib_expiry);
+  }
+  if (state.remote_active) {
+    scheduler.at(task_remote_expiry, state.remote_unlock_until);
+  } else {
+    scheduler.cancel(task_remote_expiry);
   }
 }
 
 void check_state()
 {
-  if (state.card_active || state.exit_active || state.snib_active || state.remote_active) {
+  schedule_unlock_expiries();
+
+  if (door.relay()) {
     if (!state.unlock_active) {
       relay.active(true);
       state.unlock_active = true;
       Serial.println("unlocked");
-      if (config.events) net.sendEvent("unlocked");
+      if (config.events) send_event("unlocked");
     }
   } else {
     if (state.unlock_active) {
       relay.active(false);
       state.unlock_active = false;
       Serial.println("locked");
-      if (config.events) net.sendEvent("locked");
+      if (config.events) send_event("locked");
     }
   }
 
+  // time from the card being presented to the relay being energised
+  if (unlock_latency && state.card_active && state.unlock_active) {
+    unlock_latency->add(millis() - unlock_latency_start);
+    unlock_latency = NULL;
+  }
+
   state.changed = false;
   check_leds();
 }
 
-void token_info_callback(const char *uid, bool found, const char *name, uint8_t access)
+void grant_card_access(const char *uid, const char *user, State::auth_t auth, LatencyHistogram &latency, unsigned long start)
 {
-  token_lookup_timer.detach();
+  door_event(DoorMachine::card_grant);
+  state.card_unlock_until = millis() + config.card_unlock_time;
+  strncpy(state.user, user, sizeof(state.user));
+  state.user[sizeof(state.user)-1] = '\0';
+  strncpy(state.uid, uid, sizeof(state.uid));
+  state.uid[sizeof(state.uid)-1] = '\0';
+  state.auth = auth;
+  state.changed = true;
+  buzzer.beep(100, 1000);
+  unlock_latency = &latency;
+  unlock_latency_start = start;
+}
 
-  Serial.print("token_info_callback: time=");
-  Serial.println(millis()-pending_token_time, DEC);
+bool local_lookup(const char *uid)
+{
+  unsigned long start = millis();
+  bool found = tokendb.lookup(uid);
+  latency_db_lookup.add(millis() - start);
+  return found;
+}
 
-  if (!state.card_enable) {
-    buzzer.beep(500, 256);
+// Server answer for a card that has already been let in from the local
+// database. A timeout or "not found" leaves the local decision in place,
+// the same as the fallback in token_info_callback would. A reply after
+// the timeout is still acted on, as the card may still be in.
+void token_confirm_callback(const char *uid, bool found, const char *name, uint8_t access)
+{
+  if (!found) {
     return;
   }
 
-  if (found) {
-    if (access > 0) {
-      state.card_active = true;
-      state.card_unlock_until = millis() + config.card_unlock_time;
+  bool current = state.card_active && strcmp(state.uid, uid) == 0;
+
+  tokencache.store(uid, access > 0, state.auth_online, name);
+
+  if (access > 0) {
+    if (current) {
       strncpy(state.user, name, sizeof(state.user));
       state.user[sizeof(state.user)-1] = '\0';
-      strncpy(state.uid, uid, sizeof(state.uid));
-      state.uid[sizeof(state.uid)-1] = '\0';
       state.auth = state.auth_online;
       state.changed = true;
-      buzzer.beep(100, 1000);
-      if (config.events) net.sendEvent("auth", 128, "uid=%s user=%s type=online access=granted", state.uid, state.user);
-    } else {
-      buzzer.beep(500, 256);
-      if (config.events) net.sendEvent("auth", 128, "uid=%s user=%s type=online access=denied", uid, name);
     }
-    return;
+    if (config.events) send_event("auth", 128, "uid=%s user=%s type=online access=granted", uid, name);
+  } else {
+    if (current) {
+      door_event(DoorMachine::card_end);
+      state.auth = state.auth_none;
+      strncpy(state.user, "", sizeof(state.user));
+      strncpy(state.uid, "", sizeof(state.uid));
+      state.changed = true;
+    }
+    buzzer.beep(500, 256);
+    if (config.events) send_event("auth_revoked", 128, "uid=%s user=%s", uid, name);
   }
+}
 
-  TokenDB tokendb(TOKENS_FILENAME);
-  if (tokendb.lookup(uid)) {
+void token_local_callback(const char *uid, uint32_t seq, unsigned long start, LatencyHistogram &latency)
+{
+  if (local_lookup(uid)) {
     if (tokendb.get_access_level() > 0) {
-      state.card_active = true;
-      state.card_unlock_until = millis() + config.card_unlock_time;
-      strncpy(state.user, tokendb.get_user().c_str(), sizeof(state.user));
-      state.user[sizeof(state.user)-1] = '\0';
-      strncpy(state.uid, uid, sizeof(state.uid));
-      state.uid[sizeof(state.uid)-1] = '\0';
-      state.auth = state.auth_offline;
-      state.changed = true;
-      buzzer.beep(100, 1000);
-      if (config.events) net.sendEvent("auth", 128, "uid=%s user=%s type=offline access=granted", uid, state.user);
+      trace.local_grant(seq, trace_database);
+      grant_card_access(uid, tokendb.get_user().c_str(), state.auth_offline, latency, start);
+      tokencache.store(uid, true, state.auth_offline, state.user);
+      if (config.events) send_event("auth", 160, "uid=%s user=%s type=offline access=granted time=%lu", uid, state.user, millis() - start);
       return;
     }
+    tokencache.store(uid, false, state.auth_offline, tokendb.get_user().c_str());
   }
 
+  // a card that isn't in the local database isn't cached, as this may
+  // only be a fallback for a server that was slow or busy
   buzzer.beep(500, 256);
 
-  if (config.events) net.sendEvent("auth", 128, "uid=%s user=%s type=offline access=denied", uid, name);
+  if (config.events) send_event("auth", 128, "uid=%s user= type=offline access=denied", uid);
+}
+
+void token_info_callback(TokenLookup &lookup, bool found, const char *name, uint8_t access, bool timeout)
+{
+  const char *uid = lookup.uid;
+
+  unsigned long lookup_time = millis() - lookup.start;
+  Serial.print("token_info_callback: time=");
+  Serial.println(lookup_time, DEC);
+
+  bool late = !timeout && lookup.status == TokenLookup::expired;
+  trace.token_info(lookup.seq,
+                   (found ? TRACE_FOUND : 0) | (timeout ? TRACE_TIMEOUT : 0)
+                   | (late ? TRACE_LATE : 0) | (lookup.provisional ? TRACE_PROVISIONAL : 0),
+                   access);
+
+  if (timeout) {
+    token_lookups.expire(lookup);
+    token_query_timeouts++;
+    token_query_rtt.on_timeout();
+  } else {
+    token_lookups.finish(lookup);
+    // a reply that arrives after the timeout still says how slow the
+    // link is, so it is sampled too
+    latency_server_reply.add(lookup_time);
+    token_query_rtt.sample(lookup_time);
+    if (late && !lookup.provisional) {
+      // too late to act on, but still the server's decision for next time
+      Serial.println("token_info_callback: late reply dropped");
+      if (found) {
+        tokencache.store(uid, access > 0, state.auth_online, name);
+      }
+      return;
+    }
+  }
+
+  if (lookup.provisional) {
+    token_confirm_callback(uid, found, name, access);
+    return;
+  }
+
+  if (!state.card_enable) {
+    buzzer.beep(500, 256);
+    return;
+  }
+
+  if (found) {
+    tokencache.store(uid, access > 0, state.auth_online, name);
+    if (access > 0) {
+      grant_card_access(uid, name, state.auth_online, latency_unlock_online, lookup.start);
+      if (config.events) send_event("auth", 160, "uid=%s user=%s type=online access=granted time=%lu", state.uid, state.user, lookup_time);
+    } else {
+      buzzer.beep(500, 256);
+      if (config.events) send_event("auth", 128, "uid=%s user=%s type=online access=denied", uid, name);
+    }
+    return;
+  }
+
+  token_local_callback(uid, lookup.seq, lookup.start, timeout ? latency_unlock_fallback : latency_unlock_offline);
+}
 
-  return;
+unsigned long token_query_timeout()
+{
+  if (!config.token_query_adaptive) {
+    return config.token_query_timeout;
+  }
+  return token_query_rtt.get_timeout(config.token_query_timeout,
+                                     config.token_query_timeout_min,
+                                     config.token_query_timeout_max);
+}
+
+// Hex-encode into token_hex, advancing pos, so that the token_auth
+// document can refer to the result without copying it.
+const char *token_hex_field(const uint8_t *bytes, uint8_t len, char *&pos)
+{
+  if (pos + len * 2 + 1 > token_hex + sizeof(token_hex)) {
+    Serial.println("token_present: hex buffer full");
+    token_hex_overflows++;
+    return NULL;
+  }
+  const char *field = hexlify(bytes, len, pos);
+  pos += len * 2 + 1;
+  return field;
 }
 
 void token_present(NFCToken token)
 {
+  unsigned long present_time = millis();
+  char uid[sizeof(token.uid) * 2 + 1];
+  hexlify(token.uid, token.uid_len, uid);
+
+  trace.token(token.uid, token.uid_len);
+
+  if (token.read_time > 0) {
+    latency_nfc_read.add(token.read_time);
+  }
+
   Serial.print("token_present: ");
-  Serial.println(token.uidString());
+  Serial.println(uid);
   buzzer.beep(100, 500);
 
-  DynamicJsonDocument obj(2048);
+  // a re-read of a card that is still being looked up, unless it was let
+  // in already and the lookup is only waiting to confirm that
+  TokenLookup *pending = token_lookups.find(uid);
+  if (pending && !pending->provisional) {
+    Serial.println("token_present: lookup already pending");
+    return;
+  }
+
+  // a card that was decided on moments ago
+  bool granted;
+  int auth;
+  const char *user;
+  if (state.card_enable && tokencache.lookup(uid, granted, auth, user)) {
+    if (granted) {
+      trace.local_grant(0, trace_cached);
+      grant_card_access(uid, user, (State::auth_t)auth, latency_unlock_cached, present_time);
+      if (config.events) send_event("auth", 160, "uid=%s user=%s type=cached access=granted time=%lu", state.uid, state.user, millis() - present_time);
+    } else {
+      buzzer.beep(500, 256);
+      if (config.events) send_event("auth", 128, "uid=%s user=%s type=cached access=denied", uid, user);
+    }
+    return;
+  }
+
+  TokenLookup *lookup = token_lookups.begin(uid, token_query_timeout());
+  if (!lookup) {
+    // every slot is waiting on the server, so don't add to the queue
+    Serial.println("token_present: too many lookups in flight");
+    if (state.card_enable) {
+      token_local_callback(uid, 0, present_time, latency_unlock_fallback);
+    } else {
+      buzzer.beep(500, 256);
+    }
+    return;
+  }
+  trace.token_auth(lookup->seq);
+
+  JsonDocument &obj = json_doc;
+  obj.clear();
+  char *hex = token_hex;
+  const char *field;
+  unsigned long overflows = token_hex_overflows;
   obj["cmd"] = "token_auth";
-  obj["uid"] = token.uidString();
-  if (token.ats_len > 0) {
-    obj["ats"] = hexlify(token.ats, token.ats_len);
+  obj["uid"] = (const char*)lookup->uid;
+  obj["seq"] = lookup->seq;
+  if (token.ats_len > 0 && (field = token_hex_field(token.ats, token.ats_len, hex))) {
+    obj["ats"] = field;
   }
   obj["atqa"] = (int)token.atqa;
   obj["sak"] = (int)token.sak;
-  if (token.version_len > 0) {
-    obj["version"] = hexlify(token.version, token.version_len);
+  if (token.version_len > 0 && (field = token_hex_field(token.version, token.version_len, hex))) {
+    obj["version"] = field;
   }
   if (token.ntag_counter > 0) {
     obj["ntag_counter"] = (long)token.ntag_counter;
   }
-  if (token.ntag_signature_len > 0) {
-    obj["ntag_signature"] = hexlify(token.ntag_signature, token.ntag_signature_len);
+  if (token.ntag_signature_len > 0 && (field = token_hex_field(token.ntag_signature, token.ntag_signature_len, hex))) {
+    obj["ntag_signature"] = field;
   }
-  if (token.data_len > 0) {
-    obj["data"] = hexlify(token.data, token.data_len);
+  if (token.data_len > 0 && (field = token_hex_field(token.data, token.data_len, hex))) {
+    obj["data"] = field;
   }
   if (token.read_time > 0) {
     obj["read_time"] = token.read_time;
   }
-  obj.shrinkToFit();
-
-  strncpy(pending_token, token.uidString().c_str(), sizeof(pending_token));
-  pending_token[sizeof(pending_token)-1] = '\0';
-  token_lookup_timer.once_ms(config.token_query_timeout, std::bind(&token_info_callback, pending_token, false, "", 0));
+  if (token_hex_overflows != overflows) {
+    obj["truncated"] = true;
+  }
 
-  pending_token_time = millis();
-  net.sendJson(obj, true);
-  if (config.events) net.sendEvent("token", 64, "uid=%s", pending_token);
+  send_message(obj, true);
+  if (config.events) send_event("token", 64, "uid=%s", lookup->uid);
+  latency_token_present.add(millis() - present_time);
+
+  // in offline-first mode, let the card in straight away if the local
+  // database allows it and only use the server to confirm or revoke.
+  // This comes after token_auth has gone, so that a slow local lookup
+  // (such as building the index) isn't counted in the server's RTT.
+  if (config.offline_first && state.card_enable) {
+    if (local_lookup(lookup->uid) && tokendb.get_access_level() > 0) {
+      trace.local_grant(lookup->seq, trace_database);
+      grant_card_access(lookup->uid, tokendb.get_user().c_str(), state.auth_offline, latency_unlock_offline, lookup->start);
+      lookup->provisional = true;
+      // the server has longer to revoke a card that is already in
+      token_lookups.extend(*lookup, config.token_confirm_timeout);
+      if (config.events) send_event("auth", 160, "uid=%s user=%s type=offline access=granted time=%lu", lookup->uid, state.user, millis() - lookup->start);
+    }
+  }
 }
 
 void token_removed(NFCToken token)
 {
+  char uid[sizeof(token.uid) * 2 + 1];
   Serial.print("token_removed: ");
-  Serial.println(token.uidString());
+  Serial.println(hexlify(token.uid, token.uid_len, uid));
+}
+
+void apply_power_profile()
+{
+  const PowerSettings &settings = powerprofile.current();
+  WiFi.setSleepMode((WiFiSleepType_t)settings.wifi_sleep, settings.wifi_listen_interval);
+  voltagemonitor.set_interval(settings.voltage_interval);
 }
 
 void load_wifi_config()
@@ -333,7 +836,25 @@ void load_app_config()
   nfc.per_5s_limit = config.nfc_5s_limit;
   nfc.per_1m_limit = config.nfc_1m_limit;
   relay.setInvert(config.invert_relay);
-  voltagemonitor.set_interval(config.voltage_check_interval);
+  tokendb.set_index_max_bytes(config.tokens_index_max_bytes);
+  tokendb.set_journal_max_bytes(config.tokens_journal_max_bytes);
+  eventjournal.set_max_bytes(config.event_journal_max_bytes);
+  if (!config.event_journal) {
+    eventjournal.clear();
+  }
+  tokencache.set_ttl(config.token_cache_grant_ttl, config.token_cache_deny_ttl);
+  // mains leaves the modem in the core's default sleep mode
+  PowerSettings mains = { 0, 0, WIFI_MODEM_SLEEP, 0, config.voltage_check_interval };
+  PowerSettings battery = {
+    (unsigned long)config.battery_nfc_interval,
+    (unsigned long)config.battery_loop_delay,
+    config.battery_wifi_sleep,
+    config.battery_wifi_listen_interval,
+    config.battery_voltage_check_interval
+  };
+  powerprofile.set_profile(false, mains);
+  powerprofile.set_profile(true, battery);
+  apply_power_profile();
   voltagemonitor.set_ratio(config.voltage_multiplier);
   voltagemonitor.set_threshold(config.voltage_falling_threshold, config.voltage_rising_threshold);
   state.changed = true;
@@ -348,62 +869,60 @@ void load_config()
 
 void door_open_callback()
 {
+  trace.input(trace_door_open);
   Serial.println("door-open");
   if (config.anti_bounce) {
-    if (state.exit_active) {
-      state.exit_active = false;
-    }
     if (state.card_active) {
-      state.card_active = false;
       state.auth = state.auth_none;
       strncpy(state.user, "", sizeof(state.user));
       strncpy(state.uid, "", sizeof(state.uid));
     }
+    door_event(DoorMachine::door_open_anti_bounce);
   }
   state.door_open = true;
   state.changed = true;
-  if (config.events) net.sendEvent("door_open");
+  if (config.events) send_event("door_open");
 }
 
 void door_close_callback()
 {
+  trace.input(trace_door_close);
   Serial.println("door-close");
   state.door_open = false;
   state.changed = true;
-  if (config.events) net.sendEvent("door_closed");
+  if (config.events) send_event("door_closed");
 }
 
 void exit_press_callback()
 {
+  trace.input(trace_exit_press);
   Serial.println("exit-press");
   if (state.exit_enable) {
-    state.exit_active = true;
+    door_event(DoorMachine::exit_request);
     state.exit_unlock_until = millis() + config.exit_unlock_time;
     state.changed = true;
-    if (config.events) net.sendEvent("exit_request");
+    if (config.events) send_event("exit_request");
   } else {
-    if (config.events) net.sendEvent("exit_request_ignored");
+    if (config.events) send_event("exit_request_ignored");
   }
 }
 
 void exit_longpress_callback()
 {
+  trace.input(trace_exit_longpress);
   Serial.println("exit-longpress");
   if (config.hold_exit_for_snib) {
     if (state.snib_active) {
       buzzer.beep(100, 500);
-      state.snib_active = false;
-      state.exit_active = false;
-      state.changed = true;
-      if (config.events) net.sendEvent("snib_off");
+      door_event(DoorMachine::exit_hold_snib_off);
+      if (config.events) send_event("snib_off");
     } else {
       if (state.snib_enable && (state.on_battery == false || config.allow_snib_on_battery)) {
         buzzer.beep(100, 1000);
-        state.snib_active = true;
+        door_event(DoorMachine::exit_hold_snib_on);
         state.snib_unlock_until = millis () + config.snib_unlock_time;
-        state.exit_active = false;
         state.changed = true;
-        if (config.events) net.sendEvent("snib_on");
+        if (config.events) send_event("snib_on");
       }
     }
   }
@@ -411,61 +930,72 @@ void exit_longpress_callback()
 
 void exit_release_callback()
 {
+  trace.input(trace_exit_release);
   Serial.println("exit-release");
 
   // handle exit button interactive mode
   if (state.exit_active) {
     if (config.exit_interactive_time > 0) {
       state.exit_unlock_until = millis() + config.exit_interactive_time;
+      schedule_unlock_expiries();
     }
   }
 }
 
 void snib_press_callback()
 {
+  trace.input(trace_snib_press);
   Serial.println("snib-press");
   if (state.snib_active) {
-    state.snib_active = false;
-    state.changed = true;
-    if (config.events) net.sendEvent("snib_off");
+    door_event(DoorMachine::snib_off);
+    if (config.events) send_event("snib_off");
   } else {
     if (state.snib_enable && (state.on_battery == false || config.allow_snib_on_battery)) {
-      state.snib_active = true;
+      door_event(DoorMachine::snib_on);
       state.snib_unlock_until = millis () + config.snib_unlock_time;
       state.changed = true;
-      if (config.events) net.sendEvent("snib_on");
+      if (config.events) send_event("snib_on");
     }
   }
 }
 
 void snib_longpress_callback()
 {
+  trace.input(trace_snib_longpress);
   Serial.println("snib-longpress");
 }
 
 void snib_release_callback()
 {
+  trace.input(trace_snib_release);
   Serial.println("snib-release");
 }
 
 void on_battery_callback()
 {
+  trace.power(true);
   Serial.println("on battery");
+  powerprofile.select(true);
+  apply_power_profile();
   state.on_battery = true;
   state.changed = true;
-  if (config.events) net.sendEvent("power_battery");
+  if (config.events) send_event("power_battery");
 }
 
 void on_mains_callback()
 {
+  trace.power(false);
   Serial.println("on mains");
+  powerprofile.select(false);
+  apply_power_profile();
   state.on_battery = false;
   state.changed = true;
-  if (config.events) net.sendEvent("power_mains");
+  if (config.events) send_event("power_mains");
 }
 
 void voltage_callback(float voltage)
 {
+  trace.voltage(voltage);
   state.voltage = voltage;
   //state.changed = true;
 }
@@ -473,6 +1003,7 @@ void voltage_callback(float voltage)
 void wifi_connect_callback(const WiFiEventStationModeGotIP& event)
 {
   wifi_connected = true;
+  systemmetrics.wifi_connects++;
   state.network_up = wifi_connected && network_connected;
   state.changed = true;
 }
@@ -480,6 +1011,7 @@ void wifi_connect_callback(const WiFiEventStationModeGotIP& event)
 void wifi_disconnect_callback(const WiFiEventStationModeDisconnected& event)
 {
   wifi_connected = false;
+  systemmetrics.wifi_disconnects++;
   state.network_up = wifi_connected && network_connected;
   state.changed = true;
 }
@@ -487,6 +1019,10 @@ void wifi_disconnect_callback(const WiFiEventStationModeDisconnected& event)
 void network_connect_callback()
 {
   network_connected = true;
+  systemmetrics.network_connects++;
+  event_replay_time = millis();
+  // the server may have missed any number of updates
+  state_sent_valid = false;
   state.network_up = wifi_connected && network_connected;
   state.changed = true;
 }
@@ -494,6 +1030,7 @@ void network_connect_callback()
 void network_disconnect_callback()
 {
   network_connected = false;
+  systemmetrics.network_disconnects++;
   state.network_up = wifi_connected && network_connected;
   state.changed = true;
 }
@@ -531,6 +1068,15 @@ void network_transfer_status_callback(const char *filename, int progress, bool a
   if (changed && strcmp(APP_JSON_FILENAME, filename) == 0) {
     load_app_config();
   }
+  if (strcmp(TOKENS_FILENAME, filename) == 0) {
+    // header and index are reloaded on the next lookup
+    tokendb.invalidate();
+    if (changed) {
+      // a full database supersedes any incremental updates
+      tokendb.clear_journal();
+      tokencache.clear();
+    }
+  }
 }
 
 /*************************************************************************
@@ -575,22 +1121,72 @@ void network_cmd_buzzer_tune(const JsonDocument &obj)
 
 void network_cmd_metrics_query(const JsonDocument &obj)
 {
-  DynamicJsonDocument reply(512);
+  JsonDocument &reply = json_doc;
+  reply.clear();
   reply["cmd"] = "metrics_info";
   reply["millis"] = millis();
   reply["nfc_reset_count"] = nfc.reset_count;
   reply["nfc_token_count"] = nfc.token_count;
-  reply.shrinkToFit();
-  net.sendJson(reply);
+  systemmetrics.report(reply);
+  powerprofile.report(reply.createNestedObject("power"));
+  reply["event_journal_bytes"] = eventjournal.size();
+  reply["event_journal_dropped"] = eventjournal.dropped;
+  reply["event_journal_replayed"] = eventjournal.replayed;
+  reply["event_queue_dropped"] = eventqueue.dropped;
+  reply["message_count"] = message_count;
+  reply["message_json_bytes"] = message_json_bytes;
+  reply["message_msgpack_bytes"] = message_msgpack_bytes;
+  reply["state_info_sent"] = state_info_sent;
+  reply["state_info_suppressed"] = state_info_suppressed;
+  reply["token_cache_hits"] = tokencache.hits;
+  reply["token_cache_misses"] = tokencache.misses;
+  reply["token_query_timeouts"] = token_query_timeouts;
+  reply["token_hex_overflows"] = token_hex_overflows;
+  reply["token_lookups_pending"] = token_lookups.pending();
+  reply["token_lookup_overflows"] = token_lookups.overflows;
+  reply["token_info_late"] = token_lookups.late;
+  reply["token_info_unmatched"] = token_lookups.unmatched;
+  reply["token_query_srtt"] = token_query_rtt.get_srtt();
+  reply["token_query_rttvar"] = token_query_rtt.get_rttvar();
+  reply["token_query_timeout"] = token_query_timeout();
+  JsonObject latency = reply.createNestedObject("latency");
+  latency_nfc_read.report(latency.createNestedObject("nfc_read"));
+  latency_token_present.report(latency.createNestedObject("token_present"));
+  latency_server_reply.report(latency.createNestedObject("server_reply"));
+  latency_db_lookup.report(latency.createNestedObject("db_lookup"));
+  JsonObject unlock = latency.createNestedObject("unlock");
+  latency_unlock_online.report(unlock.createNestedObject("online"));
+  latency_unlock_offline.report(unlock.createNestedObject("offline"));
+  latency_unlock_fallback.report(unlock.createNestedObject("fallback"));
+  latency_unlock_cached.report(unlock.createNestedObject("cached"));
+  send_message(reply);
 }
 
+#ifdef LOOP_PROFILER
+void network_cmd_profile_query(const JsonDocument &obj)
+{
+  // debug builds only, so this one can afford its own document
+  DynamicJsonDocument reply(4096);
+  reply["cmd"] = "profile_info";
+  reply["cpu_mhz"] = ESP.getCpuFreqMHz();
+  loopprofiler.report(reply.createNestedObject("stages"));
+  send_message(reply);
+}
+
+void network_cmd_profile_reset(const JsonDocument &obj)
+{
+  loopprofiler.reset();
+}
+#endif
+
 void network_cmd_state_query(const JsonDocument &obj)
 {
-  send_state();
+  send_state(true);
 }
 
 void network_cmd_state_set(const JsonDocument &obj)
 {
+  trace.state_set(obj);
   if (obj.containsKey("card_enable")) {
     state.card_enable = obj["card_enable"];
   }
@@ -601,26 +1197,26 @@ void network_cmd_state_set(const JsonDocument &obj)
     state.snib_enable = obj["snib_enable"];
   }
   if (obj.containsKey("card_active")) {
-    state.card_active = obj["card_active"];
+    door_event(obj["card_active"].as<bool>() ? DoorMachine::card_grant : DoorMachine::card_end);
     if (state.card_active) {
       state.card_unlock_until = millis() + config.card_unlock_time;
       buzzer.beep(100, 1000);
     }
   }
   if (obj.containsKey("exit_active")) {
-    state.exit_active = obj["exit_active"];
+    door_event(obj["exit_active"].as<bool>() ? DoorMachine::exit_request : DoorMachine::exit_end);
     if (state.exit_active) {
       state.exit_unlock_until = millis() + config.exit_unlock_time;
     }
   }
   if (obj.containsKey("snib_active")) {
-    state.snib_active = obj["snib_active"];
+    door_event(obj["snib_active"].as<bool>() ? DoorMachine::snib_on : DoorMachine::snib_off);
     if (state.snib_active) {
       state.snib_unlock_until = millis() + config.snib_unlock_time;
     }
   }
   if (obj.containsKey("remote_active")) {
-    state.remote_active = obj["remote_active"];
+    door_event(obj["remote_active"].as<bool>() ? DoorMachine::remote_on : DoorMachine::remote_off);
     if (state.remote_active) {
       state.remote_unlock_until = millis() + config.remote_unlock_time;
     }
@@ -643,40 +1239,147 @@ void network_cmd_state_set(const JsonDocument &obj)
 
 void network_cmd_token_info(const JsonDocument &obj)
 {
+  TokenLookup *lookup = token_lookups.match(obj["seq"].as<uint32_t>(), obj["uid"] | "");
+  if (!lookup) {
+    Serial.println("token_info: no matching lookup, dropped");
+    return;
+  }
   token_info_callback(
-    obj["uid"],
+    *lookup,
     obj["found"] | false,
     obj["name"] | "",
-    obj["access"] | 0
+    obj["access"] | 0,
+    false
   );
 }
 
+void network_cmd_token_update(const JsonDocument &obj)
+{
+  const char *op = obj["op"] | "add";
+  const char *uid = obj["uid"] | "";
+  bool remove = strcmp(op, "remove") == 0;
+  bool applied = tokendb.update(uid, remove, obj["access"] | 1, obj["name"] | "");
+  if (!applied) {
+    Serial.println("token_update failed");
+  }
+  tokencache.clear();
+
+  // Let the server know whether to resend. A string seq is linked to
+  // rather than copied, as there is no room for a copy in reply.
+  StaticJsonDocument<JSON_OBJECT_SIZE(4)> reply;
+  reply["cmd"] = "token_update_status";
+  reply["uid"] = uid;
+  JsonVariantConst seq = obj["seq"];
+  if (seq.is<const char*>()) {
+    reply["seq"] = seq.as<const char*>();
+  } else if (!seq.isNull()) {
+    reply["seq"] = seq;
+  }
+  reply["applied"] = applied;
+  send_message(reply);
+}
+
+void network_cmd_trace_clear(const JsonDocument &obj)
+{
+  trace.clear();
+}
+
+// Replies with the trace status and a base64 batch of records starting at
+// "offset", so that the server can pull a whole trace a batch at a time.
+void network_cmd_trace_query(const JsonDocument &obj)
+{
+  TraceRecord batch[TRACERECORDER_QUERY_BATCH];
+  char data[((sizeof(batch) + 2) / 3) * 4 + 1];
+  uint16_t offset = obj["offset"] | 0;
+  uint16_t count = trace.read(offset, batch, TRACERECORDER_QUERY_BATCH);
+  data[encode_base64((unsigned char*)batch, count * sizeof(TraceRecord), (unsigned char*)data)] = '\0';
+
+  JsonDocument &reply = json_doc;
+  reply.clear();
+  reply["cmd"] = "trace_info";
+  trace.report(reply.as<JsonObject>());
+  reply["offset"] = offset;
+  reply["count"] = count;
+  reply["data"] = (const char*)data;
+  send_message(reply);
+}
+
+unsigned long unlock_remaining(bool active, unsigned long until)
+{
+  long remaining = (long)(until - millis());
+  return active && remaining > 0 ? remaining : 0;
+}
+
+void network_cmd_trace_start(const JsonDocument &obj)
+{
+  // capped before it is narrowed, so that a large request can't wrap
+  unsigned long size = obj["records"] | TRACERECORDER_DEFAULT_SIZE;
+  if (size > TRACERECORDER_MAX_SIZE) {
+    size = TRACERECORDER_MAX_SIZE;
+  }
+  if (!trace.start(size)) {
+    if (config.events) send_event("trace_failed");
+    return;
+  }
+  unsigned long remaining[4] = {
+    unlock_remaining(state.card_active, state.card_unlock_until),
+    unlock_remaining(state.exit_active, state.exit_unlock_until),
+    unlock_remaining(state.snib_active, state.snib_unlock_until),
+    unlock_remaining(state.remote_active, state.remote_unlock_until),
+  };
+  trace.snapshot(door.get_active(),
+                 (state.card_enable ? 1 << trace_card_enable : 0)
+                 | (state.exit_enable ? 1 << trace_exit_enable : 0)
+                 | (state.snib_enable ? 1 << trace_snib_enable : 0)
+                 | (state.on_battery ? TRACE_ON_BATTERY : 0),
+                 remaining);
+}
+
+void network_cmd_trace_stop(const JsonDocument &obj)
+{
+  trace.stop();
+}
+
+void register_commands()
+{
+  // buzzer
+  commands.add(COMMAND("buzzer_beep"), network_cmd_buzzer_beep);
+  commands.add(COMMAND("buzzer_chirp"), network_cmd_buzzer_chirp);
+  commands.add(COMMAND("buzzer_click"), network_cmd_buzzer_click);
+  commands.add(COMMAND("buzzer_tune"), network_cmd_buzzer_tune);
+  // metrics
+  commands.add(COMMAND("metrics_query"), network_cmd_metrics_query);
+#ifdef LOOP_PROFILER
+  commands.add(COMMAND("profile_query"), network_cmd_profile_query);
+  commands.add(COMMAND("profile_reset"), network_cmd_profile_reset);
+#endif
+  // state
+  commands.add(COMMAND("state_query"), network_cmd_state_query);
+  commands.add(COMMAND("state_set"), network_cmd_state_set);
+  // tokens
+  commands.add(COMMAND("token_info"), network_cmd_token_info);
+  commands.add(COMMAND("token_update"), network_cmd_token_update);
+  // trace
+  commands.add(COMMAND("trace_clear"), network_cmd_trace_clear);
+  commands.add(COMMAND("trace_query"), network_cmd_trace_query);
+  commands.add(COMMAND("trace_start"), network_cmd_trace_start);
+  commands.add(COMMAND("trace_stop"), network_cmd_trace_stop);
+}
+
 void network_message_callback(const JsonDocument &obj)
 {
-  String cmd = obj["cmd"];
-
-  if (cmd == "buzzer_beep") {
-    network_cmd_buzzer_beep(obj);
-  } else if (cmd == "buzzer_chirp") {
-    network_cmd_buzzer_chirp(obj);
-  } else if (cmd == "buzzer_click") {
-    network_cmd_buzzer_click(obj);
-  } else if (cmd == "buzzer_tune") {
-    network_cmd_buzzer_tune(obj);
-  } else if (cmd == "metrics_query") {
-    network_cmd_metrics_query(obj);
-  } else if (cmd == "state_query") {
-    network_cmd_state_query(obj);
-  } else if (cmd == "state_set") {
-    network_cmd_state_set(obj);
-  } else if (cmd == "token_info") {
-    network_cmd_token_info(obj);
-  } else {
+  const char *cmd = obj["cmd"];
+
+  if (cmd && trace.is_recording()) {
+    trace.command(command_hash(cmd));
+  }
+
+  if (!commands.dispatch(cmd, obj)) {
     StaticJsonDocument<JSON_OBJECT_SIZE(3)> reply;
     reply["cmd"] = "error";
-    reply["requested_cmd"] = cmd.c_str();
+    reply["requested_cmd"] = cmd;
     reply["error"] = "not implemented";
-    net.sendJson(reply);
+    send_message(reply);
   }
 }
 
@@ -724,6 +1427,8 @@ void setup()
   }
 
   fix_filenames();
+  eventqueue.boot = ESP.random();
+  eventjournal.begin();
 
   unsigned long start_time = millis();
   while ((long)(millis() - start_time) < 500) {
@@ -751,8 +1456,13 @@ void setup()
     net.restartWithReason(NETTHING_RESTART_CONFIG_CHANGE);
   }
 
-  led.begin();
+  scheduler.set_callback(task_card_expiry, card_unlock_expired);
+  scheduler.set_callback(task_exit_expiry, exit_unlock_expired);
+  scheduler.set_callback(task_snib_expiry, snib_unlock_expired);
+  scheduler.set_callback(task_remote_expiry, remote_unlock_expired);
+  led.begin(scheduler, task_led);
 
+  register_commands();
   net.onConnect(network_connect_callback);
   net.onDisconnect(network_disconnect_callback);
   net.onRestartRequest(network_restart_callback);
@@ -778,24 +1488,75 @@ void setup()
   voltagemonitor.on_battery_callback = on_battery_callback;
   voltagemonitor.on_mains_callback = on_mains_callback;
   voltagemonitor.voltage_callback = voltage_callback;
-  voltagemonitor.begin();
+  voltagemonitor.begin(scheduler, task_voltage);
 }
 
 void loop() {
-  static unsigned long last_timeout_check = 0;
-
-  nfc.loop();
+  PROFILE_BEGIN();
+
+  systemmetrics.loop();
+  PROFILE(profile_metrics);
+  // on battery the reader is polled less often, which bounds how long a
+  // card can go unnoticed to battery_nfc_interval
+  if (powerprofile.nfc_due()) {
+    nfc.loop();
+  }
+  PROFILE(profile_nfc);
   inputs.loop();
+  PROFILE(profile_inputs);
   net.loop();
+  PROFILE(profile_net);
 
-  if ((long)(millis() - last_timeout_check) > 200) {
-    handle_timeouts();
-    last_timeout_check = millis();
+  scheduler.loop();
+  PROFILE(profile_scheduler);
+
+  TokenLookup *lookup;
+  while ((lookup = token_lookups.next_expired()) != NULL) {
+    token_info_callback(*lookup, false, "", 0, true);
   }
+  PROFILE(profile_lookups);
 
+  // the relay follows every change straight away, but state_info is sent
+  // at most once per state_min_interval, with anything that changed in
+  // the meantime folded into one trailing message
   if (state.changed) {
     check_state();
+    if (state_publish_pending) {
+      state_info_suppressed++;
+    }
+    state_publish_pending = true;
+    PROFILE(profile_state);
+  }
+  if (state_publish_pending && (long)(millis() - state_publish_time) >= config.state_min_interval) {
     send_state();
+    PROFILE(profile_publish);
+  }
+
+  if (config.state_delta && config.state_full_interval > 0
+      && (long)(millis() - state_full_time) >= config.state_full_interval) {
+    send_state(true);
+    PROFILE(profile_publish);
+  }
+
+  if (eventqueue.size() > 0) {
+    if (network_connected && eventjournal.is_empty()) {
+      if (eventqueue.age() >= (unsigned long)config.event_batch_delay) {
+        flush_events();
+      }
+    } else if (config.event_journal && eventqueue.age() >= EVENTJOURNAL_SPILL_DELAY) {
+      eventjournal.append(eventqueue);
+    }
+  }
+  replay_events();
+  PROFILE(profile_events);
+
+  tokendb.loop();
+  PROFILE(profile_tokendb);
+
+  // idle between passes on battery, unless a reply or message is waiting
+  powerprofile.count_loop();
+  if (token_lookups.pending() == 0 && !state_publish_pending) {
+    powerprofile.idle(scheduler.next_due());
   }
 
   if (firmware_restart_pending) {
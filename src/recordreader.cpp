@@ -0,0 +1,116 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#include "recordreader.hpp"
+
+void RecordReader::begin(File &_file)
+{
+  file = _file;
+  file.seek(0, SeekSet);
+  buffer_offset = 0;
+  buffer_length = 0;
+  position = 0;
+  sequential = true;
+}
+
+void RecordReader::end()
+{
+  file.close();
+  buffer_length = 0;
+  position = 0;
+}
+
+// Make at least length bytes available from the current position. Whole
+// blocks that have already been consumed are dropped from the front of
+// the buffer so that file reads always start on a block boundary. After
+// a seek only the blocks needed are read, otherwise the buffer is filled.
+bool RecordReader::fill(size_t length)
+{
+  if (position + length <= buffer_length) {
+    return true;
+  }
+
+  size_t discard = (position / RECORDREADER_BLOCK_SIZE) * RECORDREADER_BLOCK_SIZE;
+  if (discard > 0) {
+    memmove(buffer, buffer + discard, buffer_length - discard);
+    buffer_offset += discard;
+    buffer_length -= discard;
+    position -= discard;
+  }
+
+  if (position + length > sizeof(buffer)) {
+    return false;
+  }
+
+  size_t wanted = sizeof(buffer) - buffer_length;
+  if (!sequential) {
+    size_t end = position + length;
+    end = ((end + RECORDREADER_BLOCK_SIZE - 1) / RECORDREADER_BLOCK_SIZE) * RECORDREADER_BLOCK_SIZE;
+    if (end < sizeof(buffer)) {
+      wanted = end - buffer_length;
+    }
+  }
+
+  size_t count = file.read(buffer + buffer_length, wanted);
+  read_calls++;
+  read_bytes += count;
+  buffer_length += count;
+
+  return position + length <= buffer_length;
+}
+
+bool RecordReader::is_open()
+{
+  return (bool)file;
+}
+
+bool RecordReader::available()
+{
+  return fill(1);
+}
+
+int RecordReader::read()
+{
+  if (!fill(1)) {
+    return -1;
+  }
+  return buffer[position++];
+}
+
+const uint8_t *RecordReader::peek(size_t length)
+{
+  if (!fill(length)) {
+    return NULL;
+  }
+  return buffer + position;
+}
+
+void RecordReader::skip(size_t length)
+{
+  if (position + length <= buffer_length) {
+    position += length;
+  } else {
+    seek(tell() + length, sequential);
+  }
+}
+
+// Seek to an absolute offset. Set sequential when the caller is about to
+// scan forward from here, so that refills use the whole buffer.
+bool RecordReader::seek(uint32_t offset, bool _sequential)
+{
+  sequential = _sequential;
+  if (offset >= buffer_offset && offset - buffer_offset <= buffer_length) {
+    position = offset - buffer_offset;
+    return true;
+  }
+  buffer_offset = offset - (offset % RECORDREADER_BLOCK_SIZE);
+  buffer_length = 0;
+  position = offset - buffer_offset;
+  return file.seek(buffer_offset, SeekSet);
+}
+
+uint32_t RecordReader::tell()
+{
+  return buffer_offset + position;
+}
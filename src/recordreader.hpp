@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef RECORDREADER_HPP
+#define RECORDREADER_HPP
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define RECORDREADER_BLOCK_SIZE 256
+#define RECORDREADER_BUFFER_SIZE (RECORDREADER_BLOCK_SIZE * 3)
+
+// Reads a file in block-aligned chunks and hands out pointers into its
+// buffer, so that record parsers don't need to copy or make one
+// filesystem call per field. A pointer returned by peek() is only valid
+// until the next call to peek(), read(), seek() or available().
+class RecordReader
+{
+private:
+  File file;
+  uint8_t buffer[RECORDREADER_BUFFER_SIZE];
+  uint32_t buffer_offset = 0;
+  size_t buffer_length = 0;
+  size_t position = 0;
+  bool sequential = true;
+  bool fill(size_t length);
+public:
+  uint32_t read_calls = 0;
+  uint32_t read_bytes = 0;
+  void begin(File &file);
+  void end();
+  bool is_open();
+  bool available();
+  int read();
+  const uint8_t *peek(size_t length);
+  void skip(size_t length);
+  bool seek(uint32_t offset, bool sequential = false);
+  uint32_t tell();
+};
+
+#endif
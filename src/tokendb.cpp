@@ -9,152 +9,736 @@
 #include "SPIFFS.h"
 #endif
 
-TokenDB::TokenDB(const char *filename)
+TokenDB::TokenDB(const char *filename, const char *journal_filename) : journal(journal_filename)
 {
   _filename = filename;
 }
 
-bool TokenDB::query_v1(File file, uint8_t uidlen, uint8_t *uid) {
-  while (file.available()) {
-    uint8_t xlen = file.read();
-    uint8_t xuid[xlen];
-    for (int i=0; i<xlen; i++) {
-      xuid[i] = file.read();
-    }
-    if ((xlen == uidlen) && (memcmp(xuid, uid, xlen) == 0)) {
-      Serial.println("TokenDB: v1 access-granted");
-      file.close();
-      access_level = 1;
-      user = "unknown";
-      return true;
+// Forget everything cached about the tokens file. Called whenever the
+// file is being replaced; the header is reloaded on the next lookup.
+void TokenDB::invalidate()
+{
+  compact_abort();
+  journal.invalidate();
+  reader.end();
+  index.invalidate();
+  header_loaded = false;
+  dbversion = -1;
+  record_count = 0;
+}
+
+void TokenDB::set_index_max_bytes(size_t bytes)
+{
+  index.set_max_bytes(bytes);
+}
+
+void TokenDB::set_journal_max_bytes(uint32_t bytes)
+{
+  journal_max_bytes = bytes;
+}
+
+void TokenDB::hash_uid(const uint8_t *salt, uint8_t salt_length, const uint8_t *uid, uint8_t uidlen, uint8_t *hash)
+{
+  MD5Builder md5;
+  md5.begin();
+  md5.add(salt, salt_length);
+  md5.add(uid, uidlen);
+  md5.calculate();
+  md5.getBytes(hash);
+}
+
+// Parse the record at the current reader position and advance past it.
+// Returns false at the end of the file or on a truncated record.
+bool TokenDB::read_record(TokenRecord &record)
+{
+  const uint8_t *p;
+  size_t length;
+  uint8_t hash_bytes = key_length;
+
+  switch (dbversion) {
+    case 1:
+      // uid length, uid
+      if (!(p = reader.peek(1))) return false;
+      length = 1 + p[0];
+      if (!(p = reader.peek(length))) return false;
+      record.key = p + 1;
+      record.key_length = p[0];
+      record.access = 1;
+      record.user = "unknown";
+      record.user_length = 7;
+      break;
+    case 2:
+      // hashed uid, access, user length, user
+      if (!(p = reader.peek(hash_bytes + 2))) return false;
+      length = hash_bytes + 2 + p[hash_bytes + 1];
+      if (!(p = reader.peek(length))) return false;
+      record.key = p;
+      record.key_length = hash_bytes;
+      record.access = p[hash_bytes];
+      record.user = (const char*)p + hash_bytes + 2;
+      record.user_length = p[hash_bytes + 1];
+      break;
+    case 3:
+      // uid length, uid, user length, user
+      if (!(p = reader.peek(1))) return false;
+      length = p[0] + 2;
+      if (!(p = reader.peek(length))) return false;
+      length += p[p[0] + 1];
+      if (!(p = reader.peek(length))) return false;
+      record.key = p + 1;
+      record.key_length = p[0];
+      record.access = 1;
+      record.user = (const char*)p + p[0] + 2;
+      record.user_length = p[p[0] + 1];
+      break;
+    case 4:
+      // key, access, user (NUL padded)
+      length = key_length + 1 + user_length;
+      if (reader.tell() >= records_start + record_count * length) return false;
+      if (!(p = reader.peek(length))) return false;
+      record.key = p;
+      record.key_length = key_length;
+      record.access = p[key_length];
+      record.user = (const char*)p + key_length + 1;
+      record.user_length = strnlen(record.user, user_length);
+      break;
+    default:
+      return false;
+  }
+
+  record.data = p;
+  record.length = length;
+  reader.skip(length);
+  return true;
+}
+
+bool TokenDB::accept_record(TokenRecord &record)
+{
+  char new_user[256];
+  memcpy(new_user, record.user, record.user_length);
+  new_user[record.user_length] = 0;
+  access_level = record.access;
+  user = new_user;
+
+  Serial.print("TokenDB: v");
+  Serial.print(dbversion, DEC);
+  if (record.access > 0) {
+    Serial.println(" access>0");
+    return true;
+  } else {
+    Serial.println(" access=0");
+    return false;
+  }
+}
+
+bool TokenDB::query_scan(const uint8_t *key, uint8_t key_length)
+{
+  TokenRecord record;
+  reader.seek(records_start, true);
+  while (read_record(record)) {
+    if (record.key_length == key_length && memcmp(record.key, key, key_length) == 0) {
+      return accept_record(record);
     }
   }
 
-  Serial.println("TokenDB: v1 not-found");
-  file.close();
+  Serial.print("TokenDB: v");
+  Serial.print(dbversion, DEC);
+  Serial.println(" not-found");
   return false;
 }
 
-bool TokenDB::query_v2(File file, uint8_t uidlen, uint8_t *uid) {
-  int hash_bytes = file.read();
-  int salt_length = file.read();
-  char salt[salt_length+1];
+/*
+ * v4 is a sorted, fixed-width format that can be binary searched:
+ *
+ *   version (4), flags, key length, user length, record count (uint32 LE)
+ *   if flags & TOKENDB_V4_HASHED: salt length, salt
+ *   records: key, access, user (NUL padded to user length)
+ *
+ * Keys are either the first key-length bytes of md5(salt + uid), or the
+ * UID length followed by the UID, zero padded. Records are sorted by key.
+ */
+bool TokenDB::find_v4(const uint8_t *key, TokenRecord &record) {
+  uint32_t record_length = key_length + 1 + user_length;
+  uint32_t low = 0;
+  uint32_t high = record_count;
 
-  if (salt_length > 0) {
-    for (int i=0; i<salt_length; i++) {
-      salt[i] = file.read();
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    const uint8_t *p;
+    if (!reader.seek(records_start + middle * record_length) ||
+        !(p = reader.peek(key_length))) {
+      Serial.println("TokenDB: v4 short read");
+      return false;
+    }
+    int cmp = memcmp(p, key, key_length);
+    if (cmp < 0) {
+      low = middle + 1;
+    } else if (cmp > 0) {
+      high = middle;
+    } else {
+      return read_record(record);
     }
-    salt[salt_length] = 0;
-  } else {
-    salt[0] = 0;
   }
+  return false;
+}
 
-  uint8_t hash[8];
+bool TokenDB::query_v4(const uint8_t *key) {
+  TokenRecord record;
+  if (find_v4(key, record)) {
+    return accept_record(record);
+  }
+  Serial.println("TokenDB: v4 not-found");
+  return false;
+}
 
-  MD5Builder md5;
-  md5.begin();
-  md5.add((uint8_t*)salt, salt_length);
-  md5.add(uid, uidlen);
-  md5.calculate();
-  md5.getBytes(hash);
+// Derive the key that this UID is stored under in the current tokens
+// file. Returns the key length, or 0 if the UID can't be represented.
+uint8_t TokenDB::make_key(uint8_t uidlen, const uint8_t *uid, uint8_t *key)
+{
+  uint8_t hash[16];
 
-  while (file.available()) {
-    uint8_t hashed_uid[hash_bytes];
-    uint8_t access;
-    uint8_t user_length;
-    file.readBytes((char*)hashed_uid, hash_bytes);
-    access = file.read();
-    user_length = file.read();
-    char new_user[user_length+1];
-    file.readBytes(new_user, user_length);
-    new_user[user_length] = 0;
-    if (memcmp(hash, hashed_uid, hash_bytes) == 0) {
-      access_level = access;
-      user = new_user;
-      if (access > 0) {
-        Serial.println("TokenDB: v2 access>0");
-        file.close();
-        return true;
+  switch (dbversion) {
+    case 1:
+    case 3:
+      if (uidlen > 16) {
+        return 0;
+      }
+      memcpy(key, uid, uidlen);
+      return uidlen;
+    case 2:
+      hash_uid(salt, salt_length, uid, uidlen, hash);
+      memcpy(key, hash, key_length);
+      return key_length;
+    case 4:
+      if (flags & TOKENDB_V4_HASHED) {
+        hash_uid(salt, salt_length, uid, uidlen, hash);
+        memcpy(key, hash, key_length);
       } else {
-        Serial.println("TokenDB: v2 access=0");
-        file.close();
+        if (uidlen + 1 > key_length) {
+          return 0;
+        }
+        memset(key, 0, key_length);
+        key[0] = uidlen;
+        memcpy(key + 1, uid, uidlen);
+      }
+      return key_length;
+  }
+  return 0;
+}
+
+// Tidy up after a reset during compaction. A finished compaction is
+// renamed to TOKENDB_COMPACT_DONE_FILENAME before the old tokens file is
+// removed, so if the tokens file is missing that is the one to use. If
+// both exist the old file and the journal are still a complete copy, so
+// the finished file is dropped along with any partly written one.
+void TokenDB::recover()
+{
+  if (is_compacting()) {
+    return;
+  }
+  if (SPIFFS.exists(TOKENDB_COMPACT_DONE_FILENAME)) {
+    if (SPIFFS.exists(_filename)) {
+      SPIFFS.remove(TOKENDB_COMPACT_DONE_FILENAME);
+    } else {
+      Serial.println("TokenDB: recovering compacted tokens file");
+      SPIFFS.rename(TOKENDB_COMPACT_DONE_FILENAME, _filename);
+    }
+  }
+  if (SPIFFS.exists(TOKENDB_COMPACT_FILENAME)) {
+    SPIFFS.remove(TOKENDB_COMPACT_FILENAME);
+  }
+}
+
+// Open the tokens file and cache everything in its header. The file is
+// left open for subsequent lookups. A missing or unreadable file is
+// cached too, so that it isn't probed again on every card.
+bool TokenDB::load_header()
+{
+  header_loaded = true;
+  dbversion = -1;
+  record_count = 0;
+
+  recover();
+
+  if (!SPIFFS.exists(_filename)) {
+    Serial.println("TokenDB: tokens file not found");
+    return false;
+  }
+  File file = SPIFFS.open(_filename, "r");
+  if (!file) {
+    Serial.println("TokenDB: unable to open tokens file");
+    return false;
+  }
+  reader.begin(file);
+
+  int version = reader.read();
+  const uint8_t *p;
+  switch (version) {
+    case 1:
+    case 3:
+      break;
+    case 2:
+      // hash bytes, salt length, salt
+      if (!(p = reader.peek(2)) || p[0] == 0 || p[0] > 16) {
+        Serial.println("TokenDB: v2 bad header");
+        reader.end();
+        return false;
+      }
+      key_length = p[0];
+      salt_length = p[1];
+      reader.skip(2);
+      if (!(p = reader.peek(salt_length))) {
+        Serial.println("TokenDB: v2 bad header");
+        reader.end();
         return false;
       }
+      memcpy(salt, p, salt_length);
+      reader.skip(salt_length);
+      break;
+    case 4:
+      if (!(p = reader.peek(7)) || p[1] == 0 || p[1] > 16) {
+        Serial.println("TokenDB: v4 bad header");
+        reader.end();
+        return false;
+      }
+      flags = p[0];
+      key_length = p[1];
+      user_length = p[2];
+      record_count = (uint32_t)p[3] | ((uint32_t)p[4] << 8) |
+                     ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 24);
+      reader.skip(7);
+      salt_length = 0;
+      if (flags & TOKENDB_V4_HASHED) {
+        int length = reader.read();
+        if (length < 0 || !(p = reader.peek(length))) {
+          Serial.println("TokenDB: v4 bad header");
+          reader.end();
+          return false;
+        }
+        salt_length = length;
+        memcpy(salt, p, salt_length);
+        reader.skip(salt_length);
+      }
+      break;
+    default:
+      Serial.print("TokenDB: unknown version ");
+      Serial.println(version, DEC);
+      reader.end();
+      return false;
+  }
+
+  dbversion = version;
+  records_start = reader.tell();
+  return true;
+}
+
+void TokenDB::build_index()
+{
+  // v4 is already binary searchable
+  if (dbversion < 1 || dbversion > 3) {
+    index.begin(0);
+    return;
+  }
+
+  TokenRecord record;
+  uint32_t records = 0;
+  reader.seek(records_start, true);
+  while (read_record(record)) {
+    records++;
+  }
+  record_count = records;
+
+  if (index.begin(records)) {
+    reader.seek(records_start, true);
+    uint32_t offset = reader.tell();
+    while (read_record(record)) {
+      index.add(TokenIndex::fingerprint(record.key, record.key_length), offset);
+      offset = reader.tell();
     }
+    index.finish();
   }
-  Serial.println("TokenDB: v2 not-found");
-  file.close();
-  return false;
 }
 
-bool TokenDB::query_v3(File file, uint8_t uidlen, uint8_t *uid) {
-  while (file.available()) {
-    uint8_t xuidlen = file.read();
-    uint8_t xuid[xuidlen];
-    file.readBytes((char*)xuid, xuidlen);
-    uint8_t user_length = file.read();
-    char new_user[user_length+1];
-    file.readBytes(new_user, user_length);
-    new_user[user_length] = 0;
-    if ((xuidlen == uidlen) && (memcmp(xuid, uid, xuidlen) == 0)) {
-      Serial.println("TokenDB: v3 access-granted");
-      file.close();
-      access_level = 1;
-      user = new_user;
-      return true;
+bool TokenDB::query_indexed(const uint8_t *key, uint8_t length)
+{
+  uint32_t fingerprint = TokenIndex::fingerprint(key, length);
+  size_t position = index.find(fingerprint);
+
+  TokenRecord record;
+  for (; position < index.size() && index.fingerprint_at(position) == fingerprint; position++) {
+    reader.seek(index.offset_at(position));
+    if (!read_record(record)) {
+      break;
+    }
+    if (record.key_length == length && memcmp(record.key, key, length) == 0) {
+      return accept_record(record);
     }
   }
 
-  Serial.println("TokenDB: v3 not-found");
-  file.close();
+  Serial.println("TokenDB: indexed not-found");
   return false;
 }
 
-bool TokenDB::lookup(uint8_t uidlen, uint8_t *uidbytes)
+// Check the journal, which overrides the tokens file. Returns true if the
+// journal has an entry for this UID, with the lookup result in result.
+bool TokenDB::query_journal(uint8_t uidlen, uint8_t *uid, bool &result)
 {
-  //Serial.print("looking for ");
-  //Serial.print(uidlen, DEC);
-  //Serial.println(" bytes UID in tokens files");
+  TokenJournalRecord record;
+  if (!journal.find(uidlen, uid, record)) {
+    return false;
+  }
 
-  //Serial.print(uidlen, HEX);
-  //for (int i=0; i<uidlen; i++) {
-  //  Serial.print(" ");
-  //  Serial.print(uidbytes[i], HEX);
-  //}
-  //Serial.println();
-  //Serial.println("---");
+  if (record.op == TOKENJOURNAL_REMOVE) {
+    Serial.println("TokenDB: journal removed");
+    result = false;
+    return true;
+  }
 
-  access_level = 0;
-  user = "";
-  dbversion = -1;
+  char new_user[TOKENJOURNAL_MAX_USER+1];
+  memcpy(new_user, record.user, record.user_length);
+  new_user[record.user_length] = 0;
+  access_level = record.access;
+  user = new_user;
+  if (record.access > 0) {
+    Serial.println("TokenDB: journal access>0");
+    result = true;
+  } else {
+    Serial.println("TokenDB: journal access=0");
+    result = false;
+  }
+  return true;
+}
+
+bool TokenDB::query(uint8_t uidlen, uint8_t *uidbytes)
+{
+  bool result;
+  if (query_journal(uidlen, uidbytes, result)) {
+    return result;
+  }
+
+  if (!header_loaded) {
+    load_header();
+  }
+  if (dbversion < 0) {
+    return false;
+  }
+
+  uint8_t key[16];
+  uint8_t length = make_key(uidlen, uidbytes, key);
+  if (length == 0) {
+    Serial.println("TokenDB: unusable uid");
+    return false;
+  }
+
+  if (!index.is_built()) {
+    build_index();
+  }
+  if (index.is_valid()) {
+    return query_indexed(key, length);
+  }
 
-  if (SPIFFS.exists(_filename)) {
-    File tokens_file = SPIFFS.open(_filename, "r");
-    if (tokens_file) {
-      dbversion = tokens_file.read();
-      switch (dbversion) {
-        case 1:
-          return query_v1(tokens_file, uidlen, uidbytes);
-          break;
-        case 2:
-          return query_v2(tokens_file, uidlen, uidbytes);
-          break;
-        case 3:
-          return query_v3(tokens_file, uidlen, uidbytes);
-          break;
-        default:
-          Serial.print("TokenDB: unknown version ");
-          Serial.println(dbversion, DEC);
-          break;
+  switch (dbversion) {
+    case 1:
+    case 2:
+    case 3:
+      return query_scan(key, length);
+    case 4:
+      return query_v4(key);
+  }
+
+  return false;
+}
+
+int TokenDB::compare_entries(const void *a, const void *b)
+{
+  const CompactEntry *x = (const CompactEntry*)a;
+  const CompactEntry *y = (const CompactEntry*)b;
+  if (x->key_length != y->key_length) {
+    return x->key_length - y->key_length;
+  }
+  return memcmp(x->key, y->key, x->key_length);
+}
+
+TokenDB::CompactEntry *TokenDB::compact_find(const uint8_t *key, uint8_t key_length)
+{
+  CompactEntry needle;
+  memcpy(needle.key, key, key_length);
+  needle.key_length = key_length;
+  return (CompactEntry*)bsearch(&needle, compact_entries, compact_count, sizeof(CompactEntry), compare_entries);
+}
+
+// Start merging the journal into a new tokens file. The journal's keys
+// are loaded into RAM, sorted, and the new file's header is written; the
+// records are then copied across a batch at a time by compact_step().
+bool TokenDB::compact_begin()
+{
+  if (!header_loaded) {
+    load_header();
+  }
+  if (dbversion < 0) {
+    return false;
+  }
+
+  TokenJournalRecord record;
+  uint32_t offset;
+  size_t records = 0;
+  if (!journal.rewind()) {
+    return false;
+  }
+  while (journal.next(record, offset)) {
+    records++;
+  }
+  if (records == 0) {
+    return false;
+  }
+
+  size_t bytes = records * sizeof(CompactEntry);
+  if (ESP.getFreeHeap() < bytes + TOKENINDEX_HEAP_RESERVE) {
+    Serial.println("TokenDB: not enough heap to compact");
+    return false;
+  }
+  compact_entries = (CompactEntry*)malloc(bytes);
+  if (!compact_entries) {
+    Serial.println("TokenDB: not enough heap to compact");
+    return false;
+  }
+
+  // later records for the same key replace earlier ones
+  compact_count = 0;
+  journal.rewind();
+  while (journal.next(record, offset)) {
+    CompactEntry entry;
+    entry.key_length = make_key(record.uid_length, record.uid, entry.key);
+    if (entry.key_length == 0) {
+      continue;
+    }
+    entry.access = record.access;
+    entry.remove = record.op == TOKENJOURNAL_REMOVE;
+    entry.offset = offset;
+    size_t i;
+    for (i=0; i<compact_count; i++) {
+      if (compare_entries(&compact_entries[i], &entry) == 0) {
+        break;
       }
-    } else {
-      Serial.println("TokenDB: unable to open tokens file");
     }
+    compact_entries[i] = entry;
+    if (i == compact_count) {
+      compact_count++;
+    }
+  }
+  qsort(compact_entries, compact_count, sizeof(CompactEntry), compare_entries);
+
+  // v4 carries a record count in its header, so work out the new one
+  uint32_t new_count = record_count;
+  if (dbversion == 4) {
+    for (size_t i=0; i<compact_count; i++) {
+      TokenRecord existing;
+      bool exists = find_v4(compact_entries[i].key, existing);
+      if (exists && compact_entries[i].remove) {
+        new_count--;
+      } else if (!exists && !compact_entries[i].remove) {
+        new_count++;
+      }
+    }
+  }
+
+  const uint8_t *p;
+  if (!reader.seek(0) || !(p = reader.peek(records_start))) {
+    compact_abort();
+    return false;
+  }
+  compact_file = SPIFFS.open(TOKENDB_COMPACT_FILENAME, "w");
+  if (!compact_file) {
+    Serial.println("TokenDB: unable to open compaction file");
+    compact_abort();
+    return false;
+  }
+  if (dbversion == 4) {
+    uint8_t count[4] = {
+      (uint8_t)new_count, (uint8_t)(new_count >> 8),
+      (uint8_t)(new_count >> 16), (uint8_t)(new_count >> 24)
+    };
+    compact_file.write(p, 4);
+    compact_file.write(count, sizeof(count));
+    compact_file.write(p + 8, records_start - 8);
   } else {
-    Serial.println("TokenDB: tokens file not found");
+    compact_file.write(p, records_start);
   }
 
-  return false;
+  compact_offset = records_start;
+  compact_next = 0;
+  Serial.print("TokenDB: compacting ");
+  Serial.print(compact_count, DEC);
+  Serial.println(" journal entries");
+  return true;
+}
+
+// Copy the next batch of records into the new file. Returns false once
+// compaction has finished.
+bool TokenDB::compact_step()
+{
+  TokenRecord record;
+  reader.seek(compact_offset, true);
+
+  for (int i=0; i<TOKENDB_COMPACT_BATCH; i++) {
+    if (!read_record(record)) {
+      compact_finish();
+      return false;
+    }
+    CompactEntry *entry = compact_find(record.key, record.key_length);
+    if (dbversion == 4) {
+      // merge the sorted journal entries in key order
+      while (compact_next < compact_count &&
+             memcmp(compact_entries[compact_next].key, record.key, key_length) < 0) {
+        compact_write(compact_entries[compact_next++]);
+      }
+      if (entry) {
+        compact_write(compact_entries[compact_next++]);
+      }
+    }
+    if (!entry) {
+      compact_file.write(record.data, record.length);
+    }
+    compact_offset = reader.tell();
+  }
+  return true;
+}
+
+void TokenDB::compact_write(CompactEntry &entry)
+{
+  TokenJournalRecord record;
+  if (entry.remove || !journal.read_at(entry.offset, record)) {
+    return;
+  }
+
+  uint8_t access = entry.access;
+  uint8_t length = record.user_length;
+  switch (dbversion) {
+    case 1:
+      if (access > 0) {
+        compact_file.write(&entry.key_length, 1);
+        compact_file.write(entry.key, entry.key_length);
+      }
+      break;
+    case 2:
+      compact_file.write(entry.key, entry.key_length);
+      compact_file.write(&access, 1);
+      compact_file.write(&length, 1);
+      compact_file.write((const uint8_t*)record.user, length);
+      break;
+    case 3:
+      if (access > 0) {
+        compact_file.write(&entry.key_length, 1);
+        compact_file.write(entry.key, entry.key_length);
+        compact_file.write(&length, 1);
+        compact_file.write((const uint8_t*)record.user, length);
+      }
+      break;
+    case 4:
+      if (length > user_length) {
+        length = user_length;
+      }
+      compact_file.write(entry.key, entry.key_length);
+      compact_file.write(&access, 1);
+      compact_file.write((const uint8_t*)record.user, length);
+      for (uint8_t i=length; i<user_length; i++) {
+        compact_file.write((uint8_t)0);
+      }
+      break;
+  }
+}
+
+void TokenDB::compact_finish()
+{
+  while (compact_next < compact_count) {
+    compact_write(compact_entries[compact_next++]);
+  }
+  compact_file.close();
+  free(compact_entries);
+  compact_entries = NULL;
+  compact_count = 0;
+
+  // each step leaves a complete tokens file for recover() to find
+  reader.end();
+  SPIFFS.remove(TOKENDB_COMPACT_DONE_FILENAME);
+  if (!SPIFFS.rename(TOKENDB_COMPACT_FILENAME, TOKENDB_COMPACT_DONE_FILENAME)) {
+    Serial.println("TokenDB: unable to rename compaction file");
+    SPIFFS.remove(TOKENDB_COMPACT_FILENAME);
+    invalidate();
+    compact_retry_time = millis() + TOKENDB_COMPACT_RETRY;
+    return;
+  }
+  SPIFFS.remove(_filename);
+  SPIFFS.rename(TOKENDB_COMPACT_DONE_FILENAME, _filename);
+  Serial.println("TokenDB: compaction complete");
+
+  journal.clear();
+  invalidate();
+}
+
+void TokenDB::compact_abort()
+{
+  if (compact_file) {
+    compact_file.close();
+    SPIFFS.remove(TOKENDB_COMPACT_FILENAME);
+  }
+  if (compact_entries) {
+    free(compact_entries);
+    compact_entries = NULL;
+  }
+  compact_count = 0;
+  compact_next = 0;
+}
+
+bool TokenDB::is_compacting()
+{
+  return (bool)compact_file;
+}
+
+// Run background work: merge the journal into the tokens file once it
+// grows past the configured size.
+void TokenDB::loop()
+{
+  if (is_compacting()) {
+    compact_step();
+    return;
+  }
+  if (journal_max_bytes > 0 && journal.size() > journal_max_bytes &&
+      (long)(millis() - compact_retry_time) >= 0) {
+    if (!compact_begin()) {
+      compact_abort();
+      compact_retry_time = millis() + TOKENDB_COMPACT_RETRY;
+    }
+  }
+}
+
+bool TokenDB::update(const char *uid, bool remove, uint8_t access, const char *user)
+{
+  uint8_t uidbytes[7];
+  uint8_t uidlen = decode_hex(uid, uidbytes, sizeof(uidbytes));
+  if (uidlen == 0) {
+    return false;
+  }
+
+  // the new record wouldn't be in the file being written
+  compact_abort();
+
+  return journal.append(remove ? TOKENJOURNAL_REMOVE : TOKENJOURNAL_ADD,
+                        uidlen, uidbytes, access, user);
+}
+
+void TokenDB::clear_journal()
+{
+  compact_abort();
+  journal.clear();
+}
+
+bool TokenDB::lookup(uint8_t uidlen, uint8_t *uidbytes)
+{
+  access_level = 0;
+  user = "";
+
+  return query(uidlen, uidbytes);
 }
 
 bool TokenDB::lookup(const char *uid)
@@ -181,3 +765,18 @@ int TokenDB::get_version()
 {
   return dbversion;
 }
+
+uint32_t TokenDB::get_record_count()
+{
+  return record_count;
+}
+
+uint32_t TokenDB::get_read_calls()
+{
+  return reader.read_calls;
+}
+
+uint32_t TokenDB::get_read_bytes()
+{
+  return reader.read_bytes;
+}
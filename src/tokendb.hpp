@@ -7,24 +7,98 @@
 
 #include <Arduino.h>
 #include <FS.h>
+#include "recordreader.hpp"
+#include "tokenindex.hpp"
+#include "tokenjournal.hpp"
+
+#define TOKENDB_V4_HASHED 0x01
+#define TOKENDB_COMPACT_FILENAME "/tokens.tmp"
+#define TOKENDB_COMPACT_DONE_FILENAME "/tokens.new"
+#define TOKENDB_COMPACT_BATCH 32
+#define TOKENDB_COMPACT_RETRY 60000
+
+// A view of one record inside the RecordReader buffer
+struct TokenRecord {
+  const uint8_t *key;
+  uint8_t key_length;
+  uint8_t access;
+  const char *user;
+  uint8_t user_length;
+  const uint8_t *data;
+  size_t length;
+};
 
 class TokenDB
 {
 private:
   const char *_filename;
+  TokenIndex index;
+  RecordReader reader;
   int access_level;
-  int dbversion = -1;
   String user;
-  bool query_v1(File file, uint8_t uidlen, uint8_t *uid);
-  bool query_v2(File file, uint8_t uidlen, uint8_t *uid);
-  bool query_v3(File file, uint8_t uidlen, uint8_t *uid);
+  // header cache, valid until invalidate()
+  bool header_loaded = false;
+  int dbversion = -1;
+  uint8_t flags = 0;
+  uint8_t key_length = 0;
+  uint8_t user_length = 0;
+  uint8_t salt_length = 0;
+  uint8_t salt[255];
+  uint32_t record_count = 0;
+  uint32_t records_start = 0;
+  // journal and compaction
+  struct CompactEntry {
+    uint8_t key[16];
+    uint8_t key_length;
+    uint8_t access;
+    bool remove;
+    uint32_t offset;
+  };
+  TokenJournal journal;
+  uint32_t journal_max_bytes = 2048;
+  CompactEntry *compact_entries = NULL;
+  size_t compact_count = 0;
+  size_t compact_next = 0;
+  uint32_t compact_offset = 0;
+  unsigned long compact_retry_time = 0;
+  File compact_file;
+  bool load_header();
+  void recover();
+  uint8_t make_key(uint8_t uidlen, const uint8_t *uid, uint8_t *key);
+  bool query(uint8_t uidlen, uint8_t *uid);
+  bool query_journal(uint8_t uidlen, uint8_t *uid, bool &result);
+  bool query_scan(const uint8_t *key, uint8_t key_length);
+  bool query_v4(const uint8_t *key);
+  bool find_v4(const uint8_t *key, TokenRecord &record);
+  bool read_record(TokenRecord &record);
+  bool accept_record(TokenRecord &record);
+  void build_index();
+  bool query_indexed(const uint8_t *key, uint8_t key_length);
+  static int compare_entries(const void *a, const void *b);
+  CompactEntry *compact_find(const uint8_t *key, uint8_t key_length);
+  bool compact_begin();
+  bool compact_step();
+  void compact_write(CompactEntry &entry);
+  void compact_finish();
+  void compact_abort();
+  static void hash_uid(const uint8_t *salt, uint8_t salt_length, const uint8_t *uid, uint8_t uidlen, uint8_t *hash);
 public:
-  TokenDB(const char *filename);
+  TokenDB(const char *filename, const char *journal_filename);
+  void invalidate();
+  void loop();
+  void set_index_max_bytes(size_t bytes);
+  void set_journal_max_bytes(uint32_t bytes);
+  bool update(const char *uid, bool remove, uint8_t access, const char *user);
+  void clear_journal();
+  bool is_compacting();
   bool lookup(uint8_t uidlen, uint8_t *uid);
   bool lookup(const char *uid);
   int get_access_level();
   int get_version();
   String get_user();
+  uint32_t get_record_count();
+  uint32_t get_read_calls();
+  uint32_t get_read_bytes();
 };
 
 #endif
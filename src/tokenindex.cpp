@@ -0,0 +1,153 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#include "tokenindex.hpp"
+
+TokenIndex::~TokenIndex()
+{
+  invalidate();
+}
+
+uint32_t TokenIndex::fingerprint(const uint8_t *key, size_t len)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+  for (size_t i=0; i<len; i++) {
+    hash ^= key[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+int TokenIndex::compare_entries(const void *a, const void *b)
+{
+  const Entry *x = (const Entry*)a;
+  const Entry *y = (const Entry*)b;
+  if (x->fingerprint < y->fingerprint) return -1;
+  if (x->fingerprint > y->fingerprint) return 1;
+  if (x->offset < y->offset) return -1;
+  if (x->offset > y->offset) return 1;
+  return 0;
+}
+
+void TokenIndex::set_max_bytes(size_t bytes)
+{
+  if (max_bytes != bytes) {
+    max_bytes = bytes;
+    invalidate();
+  }
+}
+
+void TokenIndex::invalidate()
+{
+  if (entries) {
+    free(entries);
+    entries = NULL;
+  }
+  count = 0;
+  capacity = 0;
+  built = false;
+}
+
+// Allocate space for a number of records. Returns false (leaving the
+// index built but invalid, so callers fall back to scanning) if the
+// index would exceed the configured size or eat into the heap reserve.
+bool TokenIndex::begin(size_t records)
+{
+  if (entries) {
+    free(entries);
+    entries = NULL;
+  }
+  count = 0;
+  capacity = 0;
+  built = true;
+
+  if (records == 0) {
+    return false;
+  }
+  size_t bytes = records * sizeof(Entry);
+  if (bytes > max_bytes) {
+    Serial.print("TokenIndex: not indexing ");
+    Serial.print(records, DEC);
+    Serial.println(" records");
+    return false;
+  }
+  if (ESP.getFreeHeap() < bytes + TOKENINDEX_HEAP_RESERVE) {
+    Serial.println("TokenIndex: not enough heap");
+    return false;
+  }
+  entries = (Entry*)malloc(bytes);
+  if (!entries) {
+    Serial.println("TokenIndex: allocation failed");
+    return false;
+  }
+  capacity = records;
+  return true;
+}
+
+bool TokenIndex::add(uint32_t fingerprint, uint32_t offset)
+{
+  if (count >= capacity) {
+    return false;
+  }
+  entries[count].fingerprint = fingerprint;
+  entries[count].offset = offset;
+  count++;
+  return true;
+}
+
+void TokenIndex::finish()
+{
+  if (entries) {
+    qsort(entries, count, sizeof(Entry), compare_entries);
+    Serial.print("TokenIndex: indexed ");
+    Serial.print(count, DEC);
+    Serial.println(" records");
+  }
+}
+
+bool TokenIndex::is_built()
+{
+  return built;
+}
+
+bool TokenIndex::is_valid()
+{
+  return built && entries != NULL;
+}
+
+size_t TokenIndex::size()
+{
+  return count;
+}
+
+// Returns the position of the first entry with this fingerprint, or
+// size() if there are none.
+size_t TokenIndex::find(uint32_t fingerprint)
+{
+  size_t low = 0;
+  size_t high = count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (entries[middle].fingerprint < fingerprint) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < count && entries[low].fingerprint == fingerprint) {
+    return low;
+  }
+  return count;
+}
+
+uint32_t TokenIndex::offset_at(size_t position)
+{
+  return entries[position].offset;
+}
+
+uint32_t TokenIndex::fingerprint_at(size_t position)
+{
+  return entries[position].fingerprint;
+}
@@ -0,0 +1,41 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef TOKENINDEX_HPP
+#define TOKENINDEX_HPP
+
+#include <Arduino.h>
+
+#define TOKENINDEX_HEAP_RESERVE 8192
+
+class TokenIndex
+{
+private:
+  struct Entry {
+    uint32_t fingerprint;
+    uint32_t offset;
+  };
+  Entry *entries = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  size_t max_bytes = 8192;
+  bool built = false;
+  static int compare_entries(const void *a, const void *b);
+public:
+  ~TokenIndex();
+  static uint32_t fingerprint(const uint8_t *key, size_t len);
+  void set_max_bytes(size_t bytes);
+  void invalidate();
+  bool begin(size_t records);
+  bool add(uint32_t fingerprint, uint32_t offset);
+  void finish();
+  bool is_built();
+  bool is_valid();
+  size_t size();
+  size_t find(uint32_t fingerprint);
+  uint32_t offset_at(size_t position);
+  uint32_t fingerprint_at(size_t position);
+};
+
+#endif
@@ -0,0 +1,139 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#include "tokenjournal.hpp"
+#ifdef ESP32
+#include "SPIFFS.h"
+#endif
+
+TokenJournal::TokenJournal(const char *filename)
+{
+  _filename = filename;
+}
+
+void TokenJournal::invalidate()
+{
+  reader.end();
+  opened = false;
+  length = 0;
+}
+
+// Open the journal for reading, caching its size. A missing journal is
+// treated as empty without touching the filesystem again until the next
+// append or invalidate().
+bool TokenJournal::open()
+{
+  if (opened) {
+    return reader.is_open();
+  }
+  opened = true;
+  length = 0;
+  if (!SPIFFS.exists(_filename)) {
+    return false;
+  }
+  File file = SPIFFS.open(_filename, "r");
+  if (!file) {
+    return false;
+  }
+  length = file.size();
+  reader.begin(file);
+  return true;
+}
+
+bool TokenJournal::append(uint8_t op, uint8_t uidlen, const uint8_t *uid, uint8_t access, const char *user)
+{
+  size_t user_length = strlen(user);
+  if (user_length > TOKENJOURNAL_MAX_USER) {
+    user_length = TOKENJOURNAL_MAX_USER;
+  }
+
+  invalidate();
+  File file = SPIFFS.open(_filename, "a");
+  if (!file) {
+    Serial.println("TokenJournal: unable to open journal");
+    return false;
+  }
+  uint8_t header[2] = { op, uidlen };
+  file.write(header, sizeof(header));
+  file.write(uid, uidlen);
+  uint8_t fields[2] = { access, (uint8_t)user_length };
+  file.write(fields, sizeof(fields));
+  file.write((const uint8_t*)user, user_length);
+  file.close();
+  return true;
+}
+
+bool TokenJournal::rewind()
+{
+  if (!open()) {
+    return false;
+  }
+  return reader.seek(0, true);
+}
+
+bool TokenJournal::next(TokenJournalRecord &record, uint32_t &offset)
+{
+  const uint8_t *p;
+  size_t record_length;
+
+  offset = reader.tell();
+  // op, uid length, uid, access, user length
+  if (!(p = reader.peek(2))) return false;
+  record_length = p[1] + 4;
+  if (!(p = reader.peek(record_length))) return false;
+  record_length += p[p[1] + 3];
+  if (!(p = reader.peek(record_length))) return false;
+
+  record.op = p[0];
+  record.uid_length = p[1];
+  record.uid = p + 2;
+  record.access = p[p[1] + 2];
+  record.user_length = p[p[1] + 3];
+  record.user = (const char*)p + p[1] + 4;
+
+  reader.skip(record_length);
+  return true;
+}
+
+bool TokenJournal::read_at(uint32_t offset, TokenJournalRecord &record)
+{
+  if (!open() || !reader.seek(offset)) {
+    return false;
+  }
+  return next(record, offset);
+}
+
+bool TokenJournal::find(uint8_t uidlen, const uint8_t *uid, TokenJournalRecord &record)
+{
+  if (!rewind()) {
+    return false;
+  }
+
+  TokenJournalRecord candidate;
+  uint32_t offset;
+  uint32_t found_offset = 0;
+  bool found = false;
+  while (next(candidate, offset)) {
+    if (candidate.uid_length == uidlen && memcmp(candidate.uid, uid, uidlen) == 0) {
+      found = true;
+      found_offset = offset;
+    }
+  }
+
+  return found && read_at(found_offset, record);
+}
+
+void TokenJournal::clear()
+{
+  invalidate();
+  if (SPIFFS.exists(_filename)) {
+    SPIFFS.remove(_filename);
+  }
+}
+
+uint32_t TokenJournal::size()
+{
+  open();
+  return length;
+}
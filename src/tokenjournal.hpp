@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef TOKENJOURNAL_HPP
+#define TOKENJOURNAL_HPP
+
+#include <Arduino.h>
+#include <FS.h>
+#include "recordreader.hpp"
+
+#define TOKENJOURNAL_ADD '+'
+#define TOKENJOURNAL_REMOVE '-'
+#define TOKENJOURNAL_MAX_USER 64
+
+// A view of one journal record inside the RecordReader buffer
+struct TokenJournalRecord {
+  uint8_t op;
+  const uint8_t *uid;
+  uint8_t uid_length;
+  uint8_t access;
+  const char *user;
+  uint8_t user_length;
+};
+
+// Append-only list of changes to be applied on top of tokens.dat. Each
+// record is: op, uid length, uid, access, user length, user. The last
+// record for a UID wins.
+class TokenJournal
+{
+private:
+  const char *_filename;
+  RecordReader reader;
+  bool opened = false;
+  uint32_t length = 0;
+  bool open();
+public:
+  TokenJournal(const char *filename);
+  void invalidate();
+  bool append(uint8_t op, uint8_t uidlen, const uint8_t *uid, uint8_t access, const char *user);
+  bool find(uint8_t uidlen, const uint8_t *uid, TokenJournalRecord &record);
+  bool rewind();
+  bool next(TokenJournalRecord &record, uint32_t &offset);
+  bool read_at(uint32_t offset, TokenJournalRecord &record);
+  void clear();
+  uint32_t size();
+};
+
+#endif
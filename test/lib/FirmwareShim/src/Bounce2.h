@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BOUNCE2_H
+#define BOUNCE2_H
+
+#include <Arduino.h>
+
+// An input that follows the pin without a debounce interval, as tests
+// set levels cleanly. heldLow() fires once per press, after holdTime().
+class Bounce {
+ private:
+  uint8_t pin = 0;
+  bool state = true;
+  bool changed = false;
+  unsigned long low_since = 0;
+  unsigned long hold_time = 0;
+  bool held = false;
+
+ public:
+  void attach(int pin, int mode);
+  bool update();
+  bool read() { return state; }
+  bool rose() { return changed && state; }
+  bool fell() { return changed && !state; }
+  bool heldLow();
+  void holdTime(unsigned long ms) { hold_time = ms; }
+};
+
+#endif
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BUZZER_HPP
+#define BUZZER_HPP
+
+#include <Arduino.h>
+#include <vector>
+
+struct buzzer_note {
+  uint16_t frequency;
+  uint16_t duration;
+};
+
+struct BuzzerBeep {
+  int ms;
+  int hz;
+};
+
+// Keeps what would have been played, for tests to check.
+class Buzzer {
+ public:
+  std::vector<BuzzerBeep> beeps;
+  unsigned long chirps = 0;
+  unsigned long clicks = 0;
+  unsigned long tunes = 0;
+
+  Buzzer(int pin, bool invert) {}
+  void beep(int ms, int hz = 1000) { beeps.push_back({ms, hz}); }
+  void chirp() { chirps++; }
+  void click() { clicks++; }
+  void play(buzzer_note *tune) { tunes++; }
+};
+
+#endif
@@ -0,0 +1,369 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "FirmwareShim.h"
+#include <Arduino.h>
+#include <Bounce2.h>
+#include <FS.h>
+#include <base64.hpp>
+#include <stdarg.h>
+#include "AppConfig.hpp"
+#include "HostShim.h"
+#include "Scheduler.hpp"
+#include "TokenLookups.hpp"
+
+// main.cpp's
+extern AppConfig config;
+extern Scheduler scheduler;
+extern TokenLookups token_lookups;
+
+// NetThing
+
+void NetThing::stop() {
+  started = false;
+  host_connect(false);
+}
+
+void NetThing::loop() {
+  while (connected && !inbox.empty()) {
+    std::string json = inbox.front();
+    inbox.pop_front();
+    DynamicJsonDocument obj(4096);
+    if (deserializeJson(obj, json) == DeserializationError::Ok && receive_callback) {
+      receive_callback(obj);
+    }
+  }
+}
+
+void NetThing::restartWithReason(uint16_t reason) {
+  restarts++;
+  restart_reason = reason;
+}
+
+bool NetThing::sendJson(const JsonDocument &obj, bool wait) {
+  if (!connected) {
+    dropped++;
+    return false;
+  }
+  std::string json;
+  serializeJson(obj, json);
+  sent.push_back(json);
+  return true;
+}
+
+bool NetThing::sendEvent(const char *event) {
+  StaticJsonDocument<JSON_OBJECT_SIZE(2)> obj;
+  obj["cmd"] = "event";
+  obj["event"] = event;
+  return sendJson(obj);
+}
+
+bool NetThing::sendEvent(const char *event, size_t size, const char *format, ...) {
+  char message[size];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, size, format, args);
+  va_end(args);
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(3)> obj;
+  obj["cmd"] = "event";
+  obj["event"] = event;
+  obj["message"] = (const char*)message;
+  return sendJson(obj);
+}
+
+void NetThing::host_connect(bool up) {
+  if (up == connected || (up && !started)) {
+    return;
+  }
+  connected = up;
+  if (up && connect_callback) {
+    connect_callback();
+  } else if (!up && disconnect_callback) {
+    disconnect_callback();
+  }
+}
+
+void NetThing::host_receive(const char *json) {
+  inbox.push_back(json);
+}
+
+void NetThing::host_transfer(const char *filename, const char *content) {
+  if (content) {
+    File file = SPIFFS.open(filename, "w");
+    file.write((const uint8_t*)content, strlen(content));
+    file.close();
+  }
+  if (transfer_callback) {
+    transfer_callback(filename, 100, false, true);
+  }
+}
+
+// NFC
+
+String NFCToken::uidString() {
+  char hex[sizeof(uid) * 2 + 1];
+  for (int i=0; i<uid_len; i++) {
+    snprintf(hex + i * 2, 3, "%02x", uid[i]);
+  }
+  hex[uid_len * 2] = '\0';
+  return String(hex);
+}
+
+void NFC::loop() {
+  if (pending) {
+    pending = false;
+    token_count++;
+    if (token_present_callback) {
+      token_present_callback(current);
+    }
+  }
+  if (removed) {
+    removed = false;
+    if (token_removed_callback) {
+      token_removed_callback(current);
+    }
+  }
+}
+
+void NFC::host_present(const NFCToken &token) {
+  current = token;
+  pending = true;
+}
+
+void NFC::host_remove() {
+  removed = true;
+}
+
+// Bounce
+
+void Bounce::attach(int _pin, int mode) {
+  pin = _pin;
+  pinMode(pin, mode);
+  state = digitalRead(pin);
+}
+
+bool Bounce::update() {
+  bool level = digitalRead(pin);
+  changed = level != state;
+  state = level;
+  if (changed && !state) {
+    low_since = millis();
+    held = false;
+  }
+  return changed;
+}
+
+bool Bounce::heldLow() {
+  if (state || held || (long)(millis() - low_since) < (long)hold_time) {
+    return false;
+  }
+  held = true;
+  return true;
+}
+
+// base64
+
+static const char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int base64_value(unsigned char c) {
+  const char *p = strchr(base64_chars, c);
+  return c && p ? p - base64_chars : -1;
+}
+
+unsigned int encode_base64_length(unsigned int input_length) {
+  return (input_length + 2) / 3 * 4;
+}
+
+unsigned int decode_base64_length(unsigned char input[]) {
+  unsigned int len = 0;
+  while (base64_value(input[len]) >= 0) {
+    len++;
+  }
+  return len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+}
+
+unsigned int encode_base64(unsigned char input[], unsigned int input_length, unsigned char output[]) {
+  unsigned int o = 0;
+  for (unsigned int i=0; i<input_length; i+=3) {
+    uint32_t n = input[i] << 16;
+    if (i + 1 < input_length) n |= input[i + 1] << 8;
+    if (i + 2 < input_length) n |= input[i + 2];
+    output[o++] = base64_chars[(n >> 18) & 63];
+    output[o++] = base64_chars[(n >> 12) & 63];
+    output[o++] = i + 1 < input_length ? base64_chars[(n >> 6) & 63] : '=';
+    output[o++] = i + 2 < input_length ? base64_chars[n & 63] : '=';
+  }
+  output[o] = '\0';
+  return o;
+}
+
+unsigned int decode_base64(unsigned char input[], unsigned char output[]) {
+  unsigned int o = 0;
+  uint32_t n = 0;
+  int bits = 0;
+  for (unsigned int i=0; base64_value(input[i]) >= 0; i++) {
+    n = (n << 6) | base64_value(input[i]);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      output[o++] = (n >> bits) & 0xff;
+    }
+  }
+  return o;
+}
+
+// the harness
+
+static bool booted = false;
+
+static void write_file(const char *filename, const char *content) {
+  File file = SPIFFS.open(filename, "w");
+  file.write((const uint8_t*)content, strlen(content));
+  file.close();
+}
+
+void firmware_boot(const char *app_json) {
+  if (booted) {
+    firmware_reset(app_json);
+    return;
+  }
+  booted = true;
+  write_file("/wifi.json", "{\"ssid\":\"host\",\"password\":\"host\"}");
+  write_file("/net.json", "{\"host\":\"localhost\",\"port\":13260,\"password\":\"host\"}");
+  write_file("/app.json", app_json);
+  // well above the default mains threshold, for the voltage monitor
+  host_set_analog(A0, 1000);
+  // setup() waits half a second for the prog button
+  host_millis_step(1);
+  setup();
+  host_millis_step(0);
+  host_wifi_connect(true);
+  net.host_connect(true);
+  firmware_run(1000);
+  firmware_clear_sent();
+  buzzer.beeps.clear();
+}
+
+void firmware_reset(const char *app_json) {
+  host_set_input(FIRMWARE_DOOR_PIN, HIGH);
+  host_set_input(FIRMWARE_EXIT_PIN, HIGH);
+  host_set_input(FIRMWARE_SNIB_PIN, HIGH);
+  firmware_set_voltage(14.6, true);
+  host_wifi_connect(true);
+  net.host_connect(true);
+  net.host_transfer("/app.json", app_json);
+  net.host_receive("{\"cmd\":\"state_set\",\"card_enable\":true,\"exit_enable\":true,"
+                   "\"snib_enable\":true,\"card_active\":false,\"exit_active\":false,"
+                   "\"snib_active\":false,\"remote_active\":false}");
+  // tokens.dat "arriving" clears the cache and the journal
+  net.host_transfer("/tokens.dat", NULL);
+  // long enough for any lookup to time out and any state_info to go
+  firmware_run(60000);
+  firmware_clear_sent();
+  buzzer.beeps.clear();
+}
+
+// Nothing but the scheduler's deadlines needs the clock to the
+// millisecond unless a button is held, or a card, message or reply is
+// waiting.
+static bool firmware_idle() {
+  return !nfc.host_pending() && !net.host_pending() && token_lookups.pending() == 0
+      && digitalRead(FIRMWARE_EXIT_PIN) == HIGH && digitalRead(FIRMWARE_SNIB_PIN) == HIGH;
+}
+
+static unsigned long last_pass = 0;
+
+unsigned long firmware_step(unsigned long max_ms) {
+  unsigned long limit = millis() + max_ms;
+  // a pass that idled has moved the clock on already
+  if (millis() == last_pass && max_ms > 0) {
+    unsigned long ms = 1;
+    if (firmware_idle()) {
+      ms = scheduler.next_due();
+      if (ms > FIRMWARE_MAX_STEP) {
+        ms = FIRMWARE_MAX_STEP;
+      }
+    }
+    if (ms > max_ms) {
+      ms = max_ms;
+    }
+    host_advance_millis(ms > 0 ? ms : 1);
+  }
+  last_pass = millis();
+  loop();
+  // idling at the end of the pass doesn't go past the limit either
+  if ((long)(millis() - limit) > 0) {
+    host_set_millis(limit);
+  }
+  return last_pass;
+}
+
+void firmware_run(unsigned long ms) {
+  unsigned long end = millis() + ms;
+  while ((long)(millis() - end) < 0) {
+    firmware_step(end - millis());
+  }
+}
+
+void firmware_set_voltage(float voltage, bool sample) {
+  host_set_analog(A0, (int)(voltage / config.voltage_multiplier + 0.5));
+  if (sample) {
+    scheduler.at(FIRMWARE_TASK_VOLTAGE, millis());
+  }
+}
+
+void firmware_present(const char *uid_hex) {
+  NFCToken token;
+  size_t len = strlen(uid_hex) / 2;
+  if (len > sizeof(token.uid)) {
+    len = sizeof(token.uid);
+  }
+  for (size_t i=0; i<len; i++) {
+    char byte[3] = { uid_hex[i * 2], uid_hex[i * 2 + 1], '\0' };
+    token.uid[i] = strtoul(byte, NULL, 16);
+  }
+  token.uid_len = len;
+  nfc.host_present(token);
+}
+
+void firmware_receive(const JsonDocument &obj) {
+  std::string json;
+  serializeJson(obj, json);
+  net.host_receive(json.c_str());
+}
+
+// cheap enough to check the text before parsing
+static bool sent_is(const std::string &json, const char *cmd) {
+  std::string key = std::string("\"cmd\":\"") + cmd + "\"";
+  return json.find(key) != std::string::npos;
+}
+
+bool firmware_sent(const char *cmd, JsonDocument &obj) {
+  for (auto it = net.sent.rbegin(); it != net.sent.rend(); ++it) {
+    if (sent_is(*it, cmd)) {
+      return deserializeJson(obj, *it) == DeserializationError::Ok;
+    }
+  }
+  return false;
+}
+
+size_t firmware_sent_count(const char *cmd) {
+  size_t count = 0;
+  for (const std::string &json : net.sent) {
+    if (sent_is(json, cmd)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void firmware_clear_sent() {
+  net.sent.clear();
+}
+
+bool firmware_unlocked() {
+  return host_get_output(FIRMWARE_RELAY_PIN) == HIGH;
+}
@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FIRMWARESHIM_H
+#define FIRMWARESHIM_H
+
+#include <ArduinoJson.h>
+#include <Buzzer.hpp>
+#include <NFCReader.hpp>
+#include "NetThing.hpp"
+
+// Runs main.cpp on the host: setup() once, then loop() against the
+// stand-ins, with the test as the server, the card reader and the door's
+// inputs. The relay and LED are read back from their pins.
+
+#define FIRMWARE_DOOR_PIN 14
+#define FIRMWARE_EXIT_PIN 4
+#define FIRMWARE_SNIB_PIN 5
+#define FIRMWARE_LED_PIN 16
+#define FIRMWARE_RELAY_PIN 15
+// main.cpp's task_voltage
+#define FIRMWARE_TASK_VOLTAGE 5
+// the longest an idle firmware_step() moves the clock
+#define FIRMWARE_MAX_STEP 1000
+
+// main.cpp's
+void setup();
+void loop();
+extern NetThing net;
+extern NFC nfc;
+extern Buzzer buzzer;
+
+// Write the config files, run setup() and bring the network up. Only the
+// first call boots; after that it is firmware_reset().
+void firmware_boot(const char *app_json = "{}");
+// Push a new app.json and settle back to idle: every unlock off and
+// expired, no lookups pending, the cache cleared and nothing sent.
+void firmware_reset(const char *app_json = "{}");
+// Move the clock on, then make one loop() pass and return the time it
+// started. The clock moves 1 ms, or up to the next scheduled deadline if
+// nothing else is waiting, unless the last pass idled and so moved it
+// already; either way it ends up no more than max_ms on, so a step of 0
+// is a pass that takes no time.
+unsigned long firmware_step(unsigned long max_ms);
+void firmware_run(unsigned long ms);
+// Put a voltage on A0 and, if sample is set, have the voltage monitor
+// read it on the next pass rather than at its next interval.
+void firmware_set_voltage(float voltage, bool sample);
+void firmware_present(const char *uid_hex);
+void firmware_receive(const JsonDocument &obj);
+// the most recent message of this kind sent since the last clear
+bool firmware_sent(const char *cmd, JsonDocument &obj);
+size_t firmware_sent_count(const char *cmd);
+void firmware_clear_sent();
+bool firmware_unlocked();
+
+#endif
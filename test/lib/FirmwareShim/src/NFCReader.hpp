@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef NFCREADER_HPP
+#define NFCREADER_HPP
+
+#include <Arduino.h>
+#include <Wire.h>
+
+class PN532_I2C {
+ public:
+  PN532_I2C(TwoWire &wire) {}
+};
+
+class PN532 {
+ public:
+  PN532(PN532_I2C &interface) {}
+};
+
+// A card as the reader reports it, with the same fields as NFCReader's.
+class NFCToken {
+ public:
+  uint8_t uid[10];
+  uint8_t uid_len = 0;
+  uint16_t atqa = 0;
+  uint8_t sak = 0;
+  uint8_t ats[32];
+  uint8_t ats_len = 0;
+  uint8_t version[8];
+  uint8_t version_len = 0;
+  uint32_t ntag_counter = 0;
+  uint8_t ntag_signature[32];
+  uint8_t ntag_signature_len = 0;
+  uint8_t data[64];
+  uint8_t data_len = 0;
+  unsigned long read_time = 0;
+  String uidString();
+};
+
+// The reader, with a test presenting the cards. A card passed to
+// host_present() is reported on the next loop().
+class NFC {
+ private:
+  NFCToken current;
+  bool pending = false;
+  bool removed = false;
+
+ public:
+  bool read_counter = false;
+  int read_data = 0;
+  bool read_sig = false;
+  int pn532_check_interval = 0;
+  int pn532_reset_interval = 0;
+  int per_5s_limit = 0;
+  int per_1m_limit = 0;
+  unsigned long reset_count = 0;
+  unsigned long token_count = 0;
+  void (*token_present_callback)(NFCToken token) = NULL;
+  void (*token_removed_callback)(NFCToken token) = NULL;
+
+  NFC(PN532_I2C &interface, PN532 &reader, int reset_pin) {}
+  void loop();
+  void host_present(const NFCToken &token);
+  void host_remove();
+  bool host_pending() { return pending || removed; }
+};
+
+#endif
@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef NETTHING_HPP
+#define NETTHING_HPP
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define NETTHING_RESTART_CONFIG_CHANGE 3
+
+// The connection to the server, with a test standing in for the server.
+// Everything the firmware sends while connected is kept as JSON text in
+// sent, and messages passed to host_receive() are handed to the firmware
+// on the next loop(), the same as the library does.
+class NetThing {
+ private:
+  bool started = false;
+  bool connected = false;
+  std::deque<std::string> inbox;
+  void (*connect_callback)() = NULL;
+  void (*disconnect_callback)() = NULL;
+  void (*restart_callback)(bool immediate, bool firmware, uint16_t reason) = NULL;
+  void (*receive_callback)(const JsonDocument &obj) = NULL;
+  void (*transfer_callback)(const char *filename, int progress, bool active, bool changed) = NULL;
+
+ public:
+  std::vector<std::string> sent;
+  unsigned long dropped = 0;
+  unsigned long restarts = 0;
+  uint16_t restart_reason = 0;
+
+  NetThing(int rx_size, int tx_size) {}
+  void setWiFi(const char *ssid, const char *password) {}
+  void setWifiCheckInterval(int ms) {}
+  void setServer(const char *host, int port, bool tls, bool verify,
+                 const uint8_t *fingerprint1, const uint8_t *fingerprint2) {}
+  void setCred(const char *username, const char *password) {}
+  void setConnectionStableTime(int ms) {}
+  void setReconnectMaxTime(int ms) {}
+  void setReceiveWatchdog(int ms) {}
+  void setDebug(bool debug) {}
+  void setCommandKey(const char *key) {}
+  void setFilenamePrefix(const char *prefix) {}
+  void onConnect(void (*callback)()) { connect_callback = callback; }
+  void onDisconnect(void (*callback)()) { disconnect_callback = callback; }
+  void onRestartRequest(void (*callback)(bool, bool, uint16_t)) { restart_callback = callback; }
+  void onReceiveJson(void (*callback)(const JsonDocument &)) { receive_callback = callback; }
+  void onTransferStatus(void (*callback)(const char *, int, bool, bool)) { transfer_callback = callback; }
+  void start() { started = true; }
+  void stop();
+  void loop();
+  void restartWithReason(uint16_t reason);
+  bool sendJson(const JsonDocument &obj, bool wait = false);
+  bool sendEvent(const char *event);
+  bool sendEvent(const char *event, size_t size, const char *format, ...);
+
+  // the server's side
+  void host_connect(bool up);
+  bool host_connected() { return connected; }
+  void host_receive(const char *json);
+  bool host_pending() { return !inbox.empty(); }
+  // write a file as a transfer from the server would, and report it
+  void host_transfer(const char *filename, const char *content);
+};
+
+#endif
@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BASE64_HPP
+#define BASE64_HPP
+
+// The same calls as the base64 library, in plain C++.
+unsigned int encode_base64_length(unsigned int input_length);
+unsigned int decode_base64_length(unsigned char input[]);
+unsigned int encode_base64(unsigned char input[], unsigned int input_length, unsigned char output[]);
+unsigned int decode_base64(unsigned char input[], unsigned char output[]);
+
+#endif
@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// Just enough of the Arduino/ESP8266 core for the firmware to build on
+// the host. Nothing here talks to hardware.
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "MD5Builder.h"
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define A0 17
+#define PROGMEM
+#define FPSTR(p) (p)
+
+typedef bool boolean;
+
+// older C libraries don't have strlcpy
+size_t host_strlcpy(char *dst, const char *src, size_t size);
+#define strlcpy host_strlcpy
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+class String {
+ private:
+  std::string s;
+
+ public:
+  String() {}
+  String(const char *c) : s(c ? c : "") {}
+  String(const std::string &c) : s(c) {}
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+  bool isEmpty() const { return s.empty(); }
+  unsigned char concat(const char *c) {
+    s += c;
+    return 1;
+  }
+  long toInt() const { return atol(s.c_str()); }
+  void toCharArray(char *buf, unsigned int size) const {
+    if (size > 0) {
+      strncpy(buf, s.c_str(), size - 1);
+      buf[size - 1] = '\0';
+    }
+  }
+  char operator[](unsigned int i) const { return s[i]; }
+  bool operator==(const String &o) const { return s == o.s; }
+  bool operator==(const char *c) const { return s == c; }
+  bool operator!=(const String &o) const { return s != o.s; }
+  String operator+(const String &o) const { return String(s + o.s); }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.s); }
+};
+
+// for ArduinoJson, which adapts the result of String's operator+ too
+class StringSumHelper : public String {
+ public:
+  StringSumHelper(const String &s) : String(s) {}
+};
+
+class IPAddress {
+ private:
+  uint8_t bytes[4];
+
+ public:
+  IPAddress() : bytes{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+  uint8_t operator[](int i) const { return bytes[i]; }
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(const String &str) { return write(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(double n, int digits = 2);
+  size_t print(const IPAddress &ip);
+  size_t println() { return write("\n"); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  template <typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  size_t readBytes(char *buffer, size_t length) {
+    size_t n = 0;
+    int c;
+    while (n < length && (c = read()) >= 0) {
+      buffer[n++] = c;
+    }
+    return n;
+  }
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud) {}
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available() { return 0; }
+  int read() { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+ public:
+  uint32_t getChipId() { return 0x123456; }
+  String getSketchMD5() { return String("00000000000000000000000000000000"); }
+  void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize() { return getFreeHeap(); }
+  uint8_t getHeapFragmentation() { return 0; }
+  uint32_t getFreeContStack() { return 4096; }
+  uint32_t getCycleCount() { return micros() * getCpuFreqMHz(); }
+  uint8_t getCpuFreqMHz() { return 160; }
+  uint32_t random() { return ::random(); }
+};
+
+extern EspClass ESP;
+
+#endif
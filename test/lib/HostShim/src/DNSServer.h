@@ -0,0 +1,17 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef DNSSERVER_H
+#define DNSSERVER_H
+
+#include <Arduino.h>
+
+class DNSServer {
+ public:
+  bool start(uint16_t port, const char *domain, const IPAddress &ip) { return true; }
+  void processNextRequest() {}
+  void stop() {}
+};
+
+#endif
@@ -0,0 +1,25 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <functional>
+
+// Setup mode's web server, which never sees a client on the host.
+class ESP8266WebServer {
+ public:
+  void on(const char *uri, std::function<void()> handler) {}
+  void begin(int port) {}
+  void handleClient() {}
+  int args() { return 0; }
+  String arg(int i) { return String(); }
+  String argName(int i) { return String(); }
+  void sendHeader(const char *name, const char *value) {}
+  void send(int code, const char *content_type = NULL, const String &content = String()) {}
+};
+
+#endif
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <functional>
+#include <memory>
+
+// The station interface as far as the firmware uses it. The link only
+// comes and goes when a test calls host_wifi_connect().
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 };
+
+struct WiFiEventStationModeGotIP {
+  IPAddress ip;
+};
+
+struct WiFiEventStationModeDisconnected {
+  uint8_t reason;
+};
+
+struct WiFiEventHandlerOpaque;
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+class ESP8266WiFiClass {
+ private:
+  bool connected = false;
+  WiFiSleepType_t sleep_type = WIFI_MODEM_SLEEP;
+  uint8_t listen_interval = 0;
+  std::function<void(const WiFiEventStationModeGotIP&)> got_ip;
+  std::function<void(const WiFiEventStationModeDisconnected&)> disconnected;
+
+ public:
+  void hostname(const String &name) {}
+  WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f);
+  WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> f);
+  bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0);
+  WiFiSleepType_t getSleepMode() { return sleep_type; }
+  uint8_t getListenInterval() { return listen_interval; }
+  bool isConnected() { return connected; }
+  int32_t RSSI() { return connected ? -60 : 31; }
+  bool disconnect() { return true; }
+  bool mode(WiFiMode_t m) { return true; }
+  bool softAP(const char *ssid, const char *password) { return true; }
+  IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+  void host_connect(bool up);
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
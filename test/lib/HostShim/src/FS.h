@@ -0,0 +1,78 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FS_H
+#define FS_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <memory>
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+// A SPIFFS file backed by a file in the host directory. Copies share the
+// same handle, as they do on the device.
+class File : public Stream {
+ private:
+  std::shared_ptr<FILE> fp;
+  std::string _name;
+
+ public:
+  File() {}
+  File(FILE *f, const char *name);
+  operator bool() const { return (bool)fp; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size);
+  int available();
+  int read();
+  size_t read(uint8_t *buffer, size_t size);
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void flush();
+  void close() { fp.reset(); }
+  const char *name() const { return _name.c_str(); }
+};
+
+class Dir {
+ private:
+  std::shared_ptr<void> dir;
+  std::string _name;
+
+ public:
+  Dir() {}
+  Dir(void *d);
+  bool next();
+  bool isFile() { return !_name.empty(); }
+  String fileName() { return String(_name); }
+};
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+class FS {
+ public:
+  bool begin();
+  bool format();
+  bool info(FSInfo &info);
+  File open(const char *path, const char *mode);
+  File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path);
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to);
+  bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+  Dir openDir(const char *path);
+};
+
+extern FS SPIFFS;
+
+#endif
@@ -0,0 +1,482 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "HostShim.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#include <Wire.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+TwoWire Wire;
+FS SPIFFS;
+ESP8266WiFiClass WiFi;
+
+#define HOST_PINS 32
+
+static unsigned long host_millis = 0;
+static unsigned long host_step = 0;
+static int host_inputs[HOST_PINS];
+static bool host_inputs_set[HOST_PINS];
+static int host_analog[HOST_PINS];
+static int host_outputs[HOST_PINS];
+static unsigned long host_restart_count = 0;
+static unsigned long host_free_heap = 40000;
+static bool host_echo = false;
+static std::string host_root;
+
+// time
+
+void host_set_millis(unsigned long ms) {
+  host_millis = ms;
+}
+
+void host_advance_millis(unsigned long ms) {
+  host_millis += ms;
+}
+
+void host_millis_step(unsigned long ms) {
+  host_step = ms;
+}
+
+unsigned long millis() {
+  unsigned long now = host_millis;
+  host_millis += host_step;
+  return now;
+}
+
+unsigned long micros() {
+  return host_millis * 1000;
+}
+
+void delay(unsigned long ms) {
+  host_millis += ms;
+}
+
+void yield() {
+}
+
+// GPIO
+
+void host_set_input(uint8_t pin, int level) {
+  if (pin < HOST_PINS) {
+    host_inputs[pin] = level;
+    host_inputs_set[pin] = true;
+  }
+}
+
+void host_set_analog(uint8_t pin, int value) {
+  if (pin < HOST_PINS) {
+    host_analog[pin] = value;
+  }
+}
+
+int host_get_output(uint8_t pin) {
+  return pin < HOST_PINS ? host_outputs[pin] : 0;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < HOST_PINS) {
+    host_outputs[pin] = value;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin < HOST_PINS && host_inputs_set[pin]) {
+    return host_inputs[pin];
+  }
+  return HIGH;
+}
+
+int analogRead(uint8_t pin) {
+  return pin < HOST_PINS ? host_analog[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin < HOST_PINS) {
+    host_outputs[pin] = value;
+  }
+}
+
+// a restart can't happen on the host, so it is only counted
+
+void EspClass::restart() {
+  host_restart_count++;
+}
+
+unsigned long host_restarts() {
+  return host_restart_count;
+}
+
+size_t host_strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+// heap
+
+void host_set_free_heap(unsigned long bytes) {
+  host_free_heap = bytes;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return host_free_heap;
+}
+
+// Print and Serial
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) {
+    return print('-') + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char *p = &buf[sizeof(buf) - 1];
+  *p = '\0';
+  do {
+    int digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n);
+  return write(p);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::print(const IPAddress &ip) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return write(buf);
+}
+
+void host_serial_echo(bool echo) {
+  host_echo = echo;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (host_echo) {
+    fputc(c, stdout);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (host_echo) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
+
+// WiFi
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f) {
+  got_ip = f;
+  return WiFiEventHandler();
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> f) {
+  disconnected = f;
+  return WiFiEventHandler();
+}
+
+bool ESP8266WiFiClass::setSleepMode(WiFiSleepType_t type, uint8_t listenInterval) {
+  sleep_type = type;
+  listen_interval = listenInterval;
+  return true;
+}
+
+void ESP8266WiFiClass::host_connect(bool up) {
+  if (up == connected) {
+    return;
+  }
+  connected = up;
+  if (up && got_ip) {
+    got_ip(WiFiEventStationModeGotIP());
+  } else if (!up && disconnected) {
+    disconnected(WiFiEventStationModeDisconnected());
+  }
+}
+
+void host_wifi_connect(bool up) {
+  WiFi.host_connect(up);
+}
+
+// SPIFFS, mapped onto a host directory
+
+// a fresh temporary directory unless host_spiffs_root() has chosen one
+static std::string host_path(const char *path) {
+  if (host_root.empty()) {
+    char dir[] = "/tmp/hostshim-XXXXXX";
+    host_root = mkdtemp(dir) ? dir : ".";
+  }
+  return host_root + (path[0] == '/' ? "" : "/") + path;
+}
+
+void host_spiffs_root(const char *path) {
+  host_root = path;
+  mkdir(host_root.c_str(), 0755);
+}
+
+void host_spiffs_format() {
+  SPIFFS.format();
+}
+
+File::File(FILE *f, const char *name) : fp(f, fclose), _name(name) {
+}
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+  return fp ? fwrite(buffer, 1, size, fp.get()) : 0;
+}
+
+int File::available() {
+  return fp ? size() - position() : 0;
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+  return fp ? fread(buffer, 1, size, fp.get()) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if (!fp) {
+    return false;
+  }
+  long target = pos;
+  if (mode == SeekCur) {
+    target += position();
+  } else if (mode == SeekEnd) {
+    target += size();
+  }
+  if (target < 0 || (size_t)target > size()) {
+    return false;
+  }
+  return fseek(fp.get(), target, SEEK_SET) == 0;
+}
+
+size_t File::position() const {
+  return fp ? ftell(fp.get()) : 0;
+}
+
+size_t File::size() const {
+  if (!fp) {
+    return 0;
+  }
+  fflush(fp.get());
+  struct stat st;
+  return fstat(fileno(fp.get()), &st) == 0 ? st.st_size : 0;
+}
+
+void File::flush() {
+  if (fp) {
+    fflush(fp.get());
+  }
+}
+
+Dir::Dir(void *d) : dir(d, [](void *p) { closedir((DIR*)p); }) {
+}
+
+bool Dir::next() {
+  _name.clear();
+  struct dirent *entry;
+  while (dir && (entry = readdir((DIR*)dir.get()))) {
+    if (entry->d_type == DT_REG) {
+      _name = std::string("/") + entry->d_name;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FS::begin() {
+  return exists("/") || mkdir(host_root.c_str(), 0755) == 0;
+}
+
+bool FS::format() {
+  Dir dir = openDir("/");
+  while (dir.next()) {
+    remove(dir.fileName());
+  }
+  return true;
+}
+
+bool FS::info(FSInfo &info) {
+  memset(&info, 0, sizeof(info));
+  info.totalBytes = 3 * 1024 * 1024;
+  info.blockSize = 8192;
+  info.pageSize = 256;
+  info.maxOpenFiles = 5;
+  info.maxPathLength = 32;
+  Dir dir = openDir("/");
+  while (dir.next()) {
+    struct stat st;
+    if (stat(host_path(dir.fileName().c_str()).c_str(), &st) == 0) {
+      info.usedBytes += st.st_size;
+    }
+  }
+  return true;
+}
+
+File FS::open(const char *path, const char *mode) {
+  std::string m = mode;
+  if (m.find('b') == std::string::npos) {
+    m += 'b';
+  }
+  FILE *f = fopen(host_path(path).c_str(), m.c_str());
+  return f ? File(f, path) : File();
+}
+
+bool FS::exists(const char *path) {
+  struct stat st;
+  return stat(host_path(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path) {
+  return unlink(host_path(path).c_str()) == 0;
+}
+
+// SPIFFS won't rename over an existing file
+bool FS::rename(const char *from, const char *to) {
+  if (exists(to)) {
+    return false;
+  }
+  return ::rename(host_path(from).c_str(), host_path(to).c_str()) == 0;
+}
+
+Dir FS::openDir(const char *path) {
+  DIR *d = opendir(host_path("").c_str());
+  return d ? Dir(d) : Dir();
+}
+
+// MD5
+
+#define MD5_F(x, y, z) (((x) & (y)) | (~(x) & (z)))
+#define MD5_G(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+void MD5Builder::begin() {
+  state[0] = 0x67452301;
+  state[1] = 0xefcdab89;
+  state[2] = 0x98badcfe;
+  state[3] = 0x10325476;
+  length = 0;
+}
+
+void MD5Builder::transform(const uint8_t *data) {
+  uint32_t m[16];
+  for (int i=0; i<16; i++) {
+    m[i] = (uint32_t)data[i*4] | ((uint32_t)data[i*4+1] << 8) |
+           ((uint32_t)data[i*4+2] << 16) | ((uint32_t)data[i*4+3] << 24);
+  }
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  for (int i=0; i<64; i++) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = MD5_F(b, c, d);
+      g = i;
+    } else if (i < 32) {
+      f = MD5_G(b, c, d);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = MD5_H(b, c, d);
+      g = (3 * i + 5) % 16;
+    } else {
+      f = MD5_I(b, c, d);
+      g = (7 * i) % 16;
+    }
+    uint32_t t = d;
+    d = c;
+    c = b;
+    b = b + MD5_ROTL(a + f + md5_k[i] + m[g], md5_r[i]);
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void MD5Builder::add(const uint8_t *data, uint16_t len) {
+  for (uint16_t i=0; i<len; i++) {
+    block[length % 64] = data[i];
+    length++;
+    if (length % 64 == 0) {
+      transform(block);
+    }
+  }
+}
+
+void MD5Builder::calculate() {
+  uint64_t bits = length * 8;
+  uint8_t pad = 0x80;
+  add(&pad, 1);
+  pad = 0;
+  while (length % 64 != 56) {
+    add(&pad, 1);
+  }
+  for (int i=0; i<8; i++) {
+    uint8_t byte = bits >> (i * 8);
+    add(&byte, 1);
+  }
+  for (int i=0; i<4; i++) {
+    for (int j=0; j<4; j++) {
+      digest[i*4+j] = state[i] >> (j * 8);
+    }
+  }
+}
+
+void MD5Builder::getBytes(uint8_t *output) {
+  memcpy(output, digest, sizeof(digest));
+}
@@ -0,0 +1,34 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef HOSTSHIM_H
+#define HOSTSHIM_H
+
+#include <stdint.h>
+
+// Controls for the host stand-ins. Time only moves when a test moves it
+// (or calls delay()), so code that waits on millis() runs as fast as the
+// host allows.
+
+void host_set_millis(unsigned long ms);
+void host_advance_millis(unsigned long ms);
+// move time on by this much on every call to millis(), for code that
+// busy-waits on it; 0 (the default) stops the clock again
+void host_millis_step(unsigned long ms);
+void host_set_free_heap(unsigned long bytes);
+// GPIO: inputs read HIGH (pulled up) until set, outputs keep the last
+// value written by digitalWrite() or analogWrite()
+void host_set_input(uint8_t pin, int level);
+void host_set_analog(uint8_t pin, int value);
+int host_get_output(uint8_t pin);
+unsigned long host_restarts();
+// bring the WiFi station link up or down, firing the event handlers
+void host_wifi_connect(bool up);
+void host_serial_echo(bool echo);
+// directory that SPIFFS paths are mapped into, created if missing;
+// otherwise a new temporary directory is used
+void host_spiffs_root(const char *path);
+void host_spiffs_format();
+
+#endif
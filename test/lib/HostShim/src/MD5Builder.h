@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef MD5BUILDER_H
+#define MD5BUILDER_H
+
+#include <stdint.h>
+
+// RFC 1321 MD5, so that hashed tokens files match the ones the server
+// generates.
+class MD5Builder {
+ private:
+  uint32_t state[4];
+  uint64_t length;
+  uint8_t block[64];
+  uint8_t digest[16];
+  void transform(const uint8_t *data);
+
+ public:
+  void begin();
+  void add(const uint8_t *data, uint16_t len);
+  void calculate();
+  void getBytes(uint8_t *output);
+};
+
+#endif
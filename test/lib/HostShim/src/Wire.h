@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <Arduino.h>
+
+// No devices on the host's bus; every address is a NACK.
+class TwoWire {
+ public:
+  void begin(int sda, int scl) {}
+  void beginTransmission(uint8_t address) {}
+  uint8_t endTransmission() { return 2; }
+};
+
+extern TwoWire Wire;
+
+#endif
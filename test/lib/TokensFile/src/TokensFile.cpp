@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "TokensFile.h"
+#include <Arduino.h>
+#include <FS.h>
+#include <algorithm>
+
+#define TOKENSFILE_V2_HASH_BYTES 6
+#define TOKENSFILE_V4_KEY_LENGTH 8
+#define TOKENSFILE_V4_USER_LENGTH 20
+
+static const uint8_t salt[] = { 's', 'a', 'l', 't' };
+
+static void md5_key(const TestToken &token, uint8_t *key, uint8_t length) {
+  uint8_t hash[16];
+  MD5Builder md5;
+  md5.begin();
+  md5.add(salt, sizeof(salt));
+  md5.add(token.uid.data(), token.uid.size());
+  md5.calculate();
+  md5.getBytes(hash);
+  memcpy(key, hash, length);
+}
+
+static std::vector<TestToken> random_tokens(size_t count, unsigned int seed, bool all_7_bytes) {
+  std::vector<TestToken> tokens;
+  srand(seed);
+  for (size_t i=0; i<count; i++) {
+    TestToken token;
+    size_t length = (!all_7_bytes && i % 3 == 0) ? 4 : 7;
+    for (size_t j=0; j<length; j++) {
+      token.uid.push_back(rand() & 0xff);
+    }
+    token.access = i % 10 == 0 ? 0 : 1;
+    token.user = "user" + std::to_string(i);
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+std::vector<TestToken> make_tokens(size_t count, unsigned int seed) {
+  return random_tokens(count, seed, false);
+}
+
+std::vector<TestToken> make_absent_tokens(size_t count, unsigned int seed) {
+  return random_tokens(count, seed, true);
+}
+
+std::string uid_hex(const TestToken &token) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  for (uint8_t b : token.uid) {
+    hex += digits[b >> 4];
+    hex += digits[b & 0x0f];
+  }
+  return hex;
+}
+
+bool write_tokens_file(const char *filename, int version,
+                       const std::vector<TestToken> &tokens, bool hashed) {
+  std::vector<uint8_t> out;
+  out.push_back(version);
+
+  switch (version) {
+    case 1:
+      for (const TestToken &token : tokens) {
+        if (token.access == 0) {
+          continue;
+        }
+        out.push_back(token.uid.size());
+        out.insert(out.end(), token.uid.begin(), token.uid.end());
+      }
+      break;
+    case 2:
+      out.push_back(TOKENSFILE_V2_HASH_BYTES);
+      out.push_back(sizeof(salt));
+      out.insert(out.end(), salt, salt + sizeof(salt));
+      for (const TestToken &token : tokens) {
+        uint8_t key[TOKENSFILE_V2_HASH_BYTES];
+        md5_key(token, key, sizeof(key));
+        out.insert(out.end(), key, key + sizeof(key));
+        out.push_back(token.access);
+        out.push_back(token.user.size());
+        out.insert(out.end(), token.user.begin(), token.user.end());
+      }
+      break;
+    case 3:
+      for (const TestToken &token : tokens) {
+        if (token.access == 0) {
+          continue;
+        }
+        out.push_back(token.uid.size());
+        out.insert(out.end(), token.uid.begin(), token.uid.end());
+        out.push_back(token.user.size());
+        out.insert(out.end(), token.user.begin(), token.user.end());
+      }
+      break;
+    case 4: {
+      const size_t length = TOKENSFILE_V4_KEY_LENGTH + 1 + TOKENSFILE_V4_USER_LENGTH;
+      uint32_t count = tokens.size();
+      out.push_back(hashed ? 0x01 : 0x00);
+      out.push_back(TOKENSFILE_V4_KEY_LENGTH);
+      out.push_back(TOKENSFILE_V4_USER_LENGTH);
+      for (int i=0; i<4; i++) {
+        out.push_back(count >> (i * 8));
+      }
+      if (hashed) {
+        out.push_back(sizeof(salt));
+        out.insert(out.end(), salt, salt + sizeof(salt));
+      }
+      std::vector<std::vector<uint8_t>> records;
+      for (const TestToken &token : tokens) {
+        std::vector<uint8_t> record(length, 0);
+        if (hashed) {
+          md5_key(token, record.data(), TOKENSFILE_V4_KEY_LENGTH);
+        } else {
+          record[0] = token.uid.size();
+          memcpy(&record[1], token.uid.data(), token.uid.size());
+        }
+        record[TOKENSFILE_V4_KEY_LENGTH] = token.access;
+        memcpy(&record[TOKENSFILE_V4_KEY_LENGTH + 1], token.user.data(),
+               std::min<size_t>(token.user.size(), TOKENSFILE_V4_USER_LENGTH));
+        records.push_back(record);
+      }
+      std::sort(records.begin(), records.end(),
+                [](const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+                  return memcmp(a.data(), b.data(), TOKENSFILE_V4_KEY_LENGTH) < 0;
+                });
+      for (const std::vector<uint8_t> &record : records) {
+        out.insert(out.end(), record.begin(), record.end());
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+
+  File file = SPIFFS.open(filename, "w");
+  if (!file) {
+    return false;
+  }
+  bool ok = file.write(out.data(), out.size()) == out.size();
+  file.close();
+  return ok;
+}
@@ -0,0 +1,29 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TOKENSFILE_H
+#define TOKENSFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct TestToken {
+  std::vector<uint8_t> uid;
+  uint8_t access;
+  std::string user;
+};
+
+// count tokens with a mix of 4 and 7 byte UIDs, one in ten without access
+std::vector<TestToken> make_tokens(size_t count, unsigned int seed);
+// UIDs that aren't in a set made by make_tokens() with a different seed
+std::vector<TestToken> make_absent_tokens(size_t count, unsigned int seed);
+std::string uid_hex(const TestToken &token);
+
+// Write tokens in the layout TokenDB reads for the given version. v1 and
+// v3 have no access field, so tokens without access are left out.
+bool write_tokens_file(const char *filename, int version,
+                       const std::vector<TestToken> &tokens, bool hashed = false);
+
+#endif
@@ -0,0 +1,303 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "TraceReplay.h"
+#include <Arduino.h>
+#include <string.h>
+#include "AppConfig.hpp"
+#include "FirmwareShim.h"
+#include "HostShim.h"
+#include "TokenCache.hpp"
+#include "TokensFile.h"
+
+// main.cpp's
+extern AppConfig config;
+extern DoorMachine door;
+extern TokenCache tokencache;
+
+#define TRACEREPLAY_TOKENS "/tokens.dat"
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t *data) {
+  return data[0] | (data[1] << 8);
+}
+
+static std::string record_uid(const TraceRecord &record) {
+  char hex[TRACERECORDER_DATA_SIZE * 2 + 1];
+  for (int i=0; i<record.len; i++) {
+    snprintf(hex + i * 2, 3, "%02x", record.data[i]);
+  }
+  hex[record.len * 2] = '\0';
+  return hex;
+}
+
+static TestToken make_token(const std::string &uid) {
+  TestToken token;
+  for (size_t i=0; i + 1 < uid.size(); i+=2) {
+    token.uid.push_back(strtoul(uid.substr(i, 2).c_str(), NULL, 16));
+  }
+  token.access = 1;
+  token.user = "replay";
+  return token;
+}
+
+TraceReplayer::TraceReplayer(const char *app_json) : app_json(app_json) {
+}
+
+// Boot or reset the firmware with a tokens.dat holding every card the
+// trace shows being let in from the database.
+void TraceReplayer::start(const std::vector<TraceRecord> &records) {
+  std::map<uint32_t, std::string> lookups;
+  std::vector<TestToken> tokens;
+  std::string uid;
+  for (const TraceRecord &record : records) {
+    if (record.type == trace_token) {
+      uid = record_uid(record);
+    } else if (record.type == trace_token_auth) {
+      lookups[read_u32(record.data)] = uid;
+    } else if (record.type == trace_local_grant && record.data[4] == trace_database) {
+      uint32_t seq = read_u32(record.data);
+      tokens.push_back(make_token(seq == 0 ? uid : lookups[seq]));
+    }
+  }
+  write_tokens_file(TRACEREPLAY_TOKENS, 4, tokens);
+
+  firmware_boot(app_json.c_str());
+  started = true;
+  on_battery = false;
+  seqs.clear();
+  uids.clear();
+  outputs.clear();
+  offset = millis() - records[0].time;
+  output(millis());
+}
+
+// Run the firmware up to a point in the trace, noting every change.
+void TraceReplayer::run_to(uint32_t time) {
+  uint32_t until = time + offset;
+  while ((int32_t)(until - millis()) > 0) {
+    output(firmware_step(until - millis()));
+  }
+}
+
+// one pass, so that what was just put in front of the firmware is seen
+void TraceReplayer::step() {
+  output(firmware_step(0));
+}
+
+// what the door is doing after a pass that started at the given time
+void TraceReplayer::output(unsigned long time) {
+  TraceOutput out;
+  out.time = time - offset;
+  out.active = door.get_active();
+  out.relay = firmware_unlocked();
+  out.led = door.led(on_battery, true);
+  if (!outputs.empty()) {
+    const TraceOutput &last = outputs.back();
+    if (last.active == out.active && last.relay == out.relay && last.led == out.led) {
+      return;
+    }
+  }
+  outputs.push_back(out);
+}
+
+// The long presses aren't replayed, as the firmware sees the button held
+// and makes its own.
+void TraceReplayer::input(uint8_t input) {
+  switch (input) {
+    case trace_door_open:
+      host_set_input(FIRMWARE_DOOR_PIN, HIGH);
+      break;
+    case trace_door_close:
+      host_set_input(FIRMWARE_DOOR_PIN, LOW);
+      break;
+    case trace_exit_press:
+      host_set_input(FIRMWARE_EXIT_PIN, LOW);
+      break;
+    case trace_exit_release:
+      host_set_input(FIRMWARE_EXIT_PIN, HIGH);
+      break;
+    case trace_snib_press:
+      host_set_input(FIRMWARE_SNIB_PIN, LOW);
+      break;
+    case trace_snib_release:
+      host_set_input(FIRMWARE_SNIB_PIN, HIGH);
+      break;
+  }
+}
+
+void TraceReplayer::token(const TraceRecord &record, bool cached) {
+  std::string uid = record_uid(record);
+  if (cached) {
+    tokencache.store(uid.c_str(), true, 1, "replay");
+  }
+  firmware_present(uid.c_str());
+}
+
+// the token_auth that the replayed token_present has just sent
+void TraceReplayer::token_auth(uint32_t seq) {
+  StaticJsonDocument<1024> sent;
+  if (firmware_sent("token_auth", sent)) {
+    seqs[seq] = sent["seq"].as<uint32_t>();
+    uids[seq] = sent["uid"].as<const char*>();
+  }
+}
+
+// Timeouts aren't sent, as the firmware times the lookup out itself.
+void TraceReplayer::token_info(const uint8_t *data) {
+  uint32_t seq = read_u32(data);
+  uint8_t flags = data[4];
+  if (flags & TRACE_TIMEOUT || !seqs.count(seq)) {
+    return;
+  }
+  StaticJsonDocument<256> obj;
+  obj["cmd"] = "token_info";
+  obj["seq"] = seqs[seq];
+  obj["uid"] = uids[seq].c_str();
+  obj["found"] = (flags & TRACE_FOUND) != 0;
+  obj["access"] = data[5];
+  firmware_receive(obj);
+}
+
+void TraceReplayer::state_set(const uint8_t *data) {
+  StaticJsonDocument<512> obj;
+  obj["cmd"] = "state_set";
+  for (int i=0; i<trace_state_field_count; i++) {
+    if (data[0] & (1 << i)) {
+      obj[TraceRecorder::state_set_keys[i]] = (data[1] & (1 << i)) != 0;
+    }
+  }
+  firmware_receive(obj);
+}
+
+void TraceReplayer::voltage(uint16_t centivolts) {
+  firmware_set_voltage(centivolts / 100.0, true);
+}
+
+// A change of power always follows a voltage record, unless the voltage
+// moved too little to be recorded, so this only forces the matter then.
+void TraceReplayer::power(bool battery) {
+  on_battery = battery;
+  float voltage = analogRead(A0) * config.voltage_multiplier;
+  if (battery && voltage >= config.voltage_falling_threshold) {
+    firmware_set_voltage(config.voltage_falling_threshold - 0.5, true);
+  } else if (!battery && voltage <= config.voltage_rising_threshold) {
+    firmware_set_voltage(config.voltage_rising_threshold + 0.5, true);
+  }
+}
+
+// Each unlock is started with its own time cut to what was left of it,
+// then the config is put back.
+void TraceReplayer::snapshot(const TraceRecord &record) {
+  uint8_t active = record.data[0];
+  uint8_t flags = record.data[1];
+  power(flags & TRACE_ON_BATTERY);
+  step();
+
+  StaticJsonDocument<256> obj;
+  obj["cmd"] = "state_set";
+  obj["card_enable"] = (flags & (1 << trace_card_enable)) != 0;
+  obj["exit_enable"] = (flags & (1 << trace_exit_enable)) != 0;
+  obj["snib_enable"] = (flags & (1 << trace_snib_enable)) != 0;
+  firmware_receive(obj);
+  step();
+
+  static const char *keys[4] = { "card_active", "exit_active", "snib_active", "remote_active" };
+  int *times[4] = {
+    &config.card_unlock_time,
+    &config.exit_unlock_time,
+    &config.snib_unlock_time,
+    &config.remote_unlock_time,
+  };
+  for (int i=0; i<4; i++) {
+    if (!(active & (1 << i))) {
+      continue;
+    }
+    int saved = *times[i];
+    *times[i] = TraceRecorder::snapshot_remaining(record, i);
+    obj.clear();
+    obj["cmd"] = "state_set";
+    obj[keys[i]] = true;
+    firmware_receive(obj);
+    step();
+    *times[i] = saved;
+  }
+}
+
+void TraceReplayer::replay(const std::vector<TraceRecord> &records) {
+  if (records.empty()) {
+    return;
+  }
+  if (!started) {
+    start(records);
+  }
+  for (size_t i=0; i<records.size(); i++) {
+    const TraceRecord &record = records[i];
+    run_to(record.time);
+    switch (record.type) {
+      case trace_start:
+        break;
+      case trace_input:
+        input(record.data[0]);
+        break;
+      case trace_token:
+        token(record, i + 1 < records.size() && records[i + 1].type == trace_local_grant
+                      && records[i + 1].data[4] == trace_cached);
+        break;
+      case trace_token_auth:
+        token_auth(read_u32(record.data));
+        break;
+      case trace_token_info:
+        token_info(record.data);
+        break;
+      case trace_state_set:
+        state_set(record.data);
+        break;
+      case trace_voltage:
+        voltage(read_u16(record.data));
+        break;
+      case trace_power:
+        power(record.data[0]);
+        break;
+      case trace_snapshot:
+        snapshot(record);
+        break;
+      case trace_command:
+      case trace_local_grant:
+        break;
+      default:
+        unknown++;
+        break;
+    }
+    step();
+    replayed++;
+  }
+}
+
+void TraceReplayer::finish(uint32_t time) {
+  run_to(time);
+}
+
+uint8_t TraceReplayer::get_active() {
+  return door.get_active();
+}
+
+// The records as TraceRecorder::read() lays them out, which is how
+// trace_query sends them.
+size_t TraceReplayer::parse(const uint8_t *bytes, size_t len, std::vector<TraceRecord> &out) {
+  size_t count = len / sizeof(TraceRecord);
+  for (size_t i=0; i<count; i++) {
+    const uint8_t *p = bytes + i * sizeof(TraceRecord);
+    TraceRecord record;
+    record.time = read_u32(p);
+    record.type = p[4];
+    record.len = p[5];
+    memcpy(record.data, p + 6, sizeof(record.data));
+    out.push_back(record);
+  }
+  return count;
+}
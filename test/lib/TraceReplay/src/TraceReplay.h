@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "DoorMachine.hpp"
+#include "TraceRecorder.hpp"
+
+// the door's outputs from a point in time until the next change
+struct TraceOutput {
+  uint32_t time;
+  uint8_t active;
+  bool relay;
+  DoorMachine::led_t led;
+};
+
+// Feeds a trace pulled off a device back through main.cpp itself, by way
+// of FirmwareShim, and lists every change to the relay and LED with the
+// time it happened, in the trace's own time. Inputs become pin levels,
+// tokens are presented to the reader, token_info and state_set records
+// become messages from the server and voltages are put on A0, so the
+// firmware makes every decision again and a replay that differs from the
+// trace is a change in behaviour.
+//
+// Cards the device let in from its database are written to tokens.dat
+// before the replay starts, and a card it let in from its cache is cached
+// again just before it is presented. Anything the firmware works out for
+// itself, such as a lookup timing out, is left to it. The network isn't
+// traced, so it is always up and the LED is worked out on that basis.
+class TraceReplayer {
+ private:
+  std::string app_json;
+  bool started = false;
+  bool on_battery = false;
+  // host millis less trace time
+  uint32_t offset = 0;
+  // a recorded lookup seq to the replayed one, and to its UID
+  std::map<uint32_t, uint32_t> seqs;
+  std::map<uint32_t, std::string> uids;
+  void start(const std::vector<TraceRecord> &records);
+  void run_to(uint32_t time);
+  void step();
+  void output(unsigned long time);
+  void input(uint8_t input);
+  void token(const TraceRecord &record, bool cached);
+  void token_auth(uint32_t seq);
+  void token_info(const uint8_t *data);
+  void state_set(const uint8_t *data);
+  void voltage(uint16_t centivolts);
+  void power(bool battery);
+  void snapshot(const TraceRecord &record);
+
+ public:
+  std::vector<TraceOutput> outputs;
+  unsigned long replayed = 0;
+  unsigned long unknown = 0;
+  TraceReplayer(const char *app_json = "{}");
+  void replay(const std::vector<TraceRecord> &records);
+  void finish(uint32_t time);
+  uint8_t get_active();
+  static size_t parse(const uint8_t *bytes, size_t len, std::vector<TraceRecord> &out);
+};
+
+#endif
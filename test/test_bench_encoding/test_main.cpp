@@ -0,0 +1,250 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// JSON against MessagePack for the messages the door sends most: size,
+// and the time to encode each and to decode it again as the server would.
+// The documents are the ones main.cpp actually sends, caught on their way
+// to the stand-in NetThing: token_auth for a plain card and for an NTAG
+// read with its signature and data, a full and a delta state_info, and
+// event_batch.
+//
+//   pio test -e native -f test_bench_encoding -v
+//
+// Results are printed as JSON and written to bench_encoding.json, or to
+// $BENCH_ENCODING_OUTPUT if it is set. Sizes carry over to the device;
+// host times only compare one encoding, or one build, with another.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "FirmwareShim.h"
+#include "HostShim.h"
+
+#define ROUNDS 10000
+#define DOC_SIZE 2048
+
+static std::vector<std::string> results;
+
+struct Encoding {
+  size_t bytes = 0;
+  double encode_ns = 0;
+  double decode_ns = 0;
+};
+
+template <typename F>
+static double ns_per_round(F round) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<ROUNDS; i++) {
+    round();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / ROUNDS;
+}
+
+// decoding gives back what was encoded
+static bool same(const JsonDocument &a, const JsonDocument &b) {
+  std::string sa, sb;
+  serializeJson(a, sa);
+  serializeJson(b, sb);
+  return sa == sb;
+}
+
+static Encoding json(const JsonDocument &doc) {
+  Encoding result;
+  char buffer[DOC_SIZE];
+  result.bytes = serializeJson(doc, buffer, sizeof(buffer));
+  result.encode_ns = ns_per_round([&]() { serializeJson(doc, buffer, sizeof(buffer)); });
+  StaticJsonDocument<DOC_SIZE> decoded;
+  TEST_ASSERT_TRUE(deserializeJson(decoded, (const char*)buffer, result.bytes) == DeserializationError::Ok);
+  TEST_ASSERT_TRUE(same(decoded, doc));
+  result.decode_ns = ns_per_round([&]() { deserializeJson(decoded, (const char*)buffer, result.bytes); });
+  return result;
+}
+
+static Encoding msgpack(const JsonDocument &doc) {
+  Encoding result;
+  char buffer[DOC_SIZE];
+  result.bytes = serializeMsgPack(doc, buffer, sizeof(buffer));
+  result.encode_ns = ns_per_round([&]() { serializeMsgPack(doc, buffer, sizeof(buffer)); });
+  StaticJsonDocument<DOC_SIZE> decoded;
+  TEST_ASSERT_TRUE(deserializeMsgPack(decoded, (const char*)buffer, result.bytes) == DeserializationError::Ok);
+  TEST_ASSERT_TRUE(same(decoded, doc));
+  result.decode_ns = ns_per_round([&]() { deserializeMsgPack(decoded, (const char*)buffer, result.bytes); });
+  return result;
+}
+
+static std::string encoding_json(const Encoding &encoding) {
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "{\"bytes\":%lu,\"encode_ns\":%.1f,\"decode_ns\":%.1f}",
+           (unsigned long)encoding.bytes, encoding.encode_ns, encoding.decode_ns);
+  return buffer;
+}
+
+static void bench(const char *name, const JsonDocument &doc) {
+  Encoding j = json(doc);
+  Encoding m = msgpack(doc);
+  TEST_ASSERT_LESS_OR_EQUAL(j.bytes, m.bytes);
+
+  std::string result = "{\"message\":\"";
+  result += name;
+  result += "\",\"json\":" + encoding_json(j);
+  result += ",\"msgpack\":" + encoding_json(m);
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), ",\"msgpack_size_pct\":%.1f}", 100.0 * m.bytes / j.bytes);
+  result += buffer;
+  results.push_back(result);
+  printf("%s\n", result.c_str());
+}
+
+// the last one of these main.cpp sent
+static void sent(const char *cmd, JsonDocument &doc) {
+  TEST_ASSERT_TRUE_MESSAGE(firmware_sent(cmd, doc), cmd);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_token_auth() {
+  StaticJsonDocument<DOC_SIZE> doc;
+  firmware_reset();
+  firmware_clear_sent();
+  firmware_present("04a1b2c3d4e5f6");
+  firmware_run(10);
+  sent("token_auth", doc);
+  bench("token_auth", doc);
+}
+
+// an NTAG215 read with its version, counter, signature and a page of data
+void test_token_auth_ntag() {
+  NFCToken token;
+  const uint8_t uid[] = { 0x04, 0x5d, 0x2a, 0x6a, 0x8f, 0x61, 0x80 };
+  const uint8_t version[] = { 0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x11, 0x03 };
+  memcpy(token.uid, uid, sizeof(uid));
+  token.uid_len = sizeof(uid);
+  token.atqa = 0x0044;
+  token.sak = 0x00;
+  memcpy(token.version, version, sizeof(version));
+  token.version_len = sizeof(version);
+  token.ntag_counter = 1207;
+  for (int i=0; i<32; i++) {
+    token.ntag_signature[i] = 0x9b ^ (i * 37);
+  }
+  token.ntag_signature_len = 32;
+  for (int i=0; i<16; i++) {
+    token.data[i] = 0x03 + i * 11;
+  }
+  token.data_len = 16;
+  token.read_time = 84;
+
+  StaticJsonDocument<DOC_SIZE> doc;
+  firmware_reset();
+  firmware_clear_sent();
+  nfc.host_present(token);
+  firmware_run(10);
+  sent("token_auth", doc);
+  bench("token_auth_ntag", doc);
+}
+
+void test_state_info() {
+  StaticJsonDocument<DOC_SIZE> doc;
+  firmware_reset();
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"state_query\"}");
+  firmware_run(1000);
+  sent("state_info", doc);
+  bench("state_info", doc);
+}
+
+void test_state_info_delta() {
+  StaticJsonDocument<DOC_SIZE> doc;
+  firmware_reset("{\"state_delta\":true}");
+  net.host_receive("{\"cmd\":\"state_query\"}");
+  firmware_run(1000);
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"state_set\",\"remote_active\":true}");
+  firmware_run(1000);
+  sent("state_info", doc);
+  bench("state_info_delta", doc);
+}
+
+// a door opened from inside, held open a while and a card presented
+void test_event_batch() {
+  StaticJsonDocument<DOC_SIZE> doc;
+  firmware_reset("{\"events\":true,\"event_batch_delay\":5000}");
+  firmware_clear_sent();
+  host_set_input(FIRMWARE_EXIT_PIN, LOW);
+  firmware_run(100);
+  host_set_input(FIRMWARE_EXIT_PIN, HIGH);
+  host_set_input(FIRMWARE_DOOR_PIN, LOW);
+  firmware_run(500);
+  firmware_present("04a1b2c3d4e5f6");
+  firmware_run(2000);
+  host_set_input(FIRMWARE_DOOR_PIN, HIGH);
+  firmware_run(5000);
+  sent("event_batch", doc);
+  TEST_ASSERT_GREATER_OR_EQUAL(3, doc["events"].size());
+  bench("event_batch", doc);
+}
+
+// what message_sizes reports for the same traffic
+void test_message_sizes() {
+  DynamicJsonDocument doc(DOC_SIZE * 4);
+  firmware_reset("{\"message_sizes\":true,\"events\":true,\"event_batch_delay\":5000}");
+  for (int i=0; i<10; i++) {
+    firmware_present("04a1b2c3d4e5f6");
+    firmware_run(2000);
+  }
+  firmware_run(5000);
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"metrics_query\"}");
+  firmware_run(10);
+  sent("metrics_info", doc);
+  TEST_ASSERT_TRUE(doc.containsKey("latency"));
+  unsigned long json_bytes = doc["message_json_bytes"];
+  unsigned long msgpack_bytes = doc["message_msgpack_bytes"];
+  TEST_ASSERT_GREATER_OR_EQUAL(10, doc["message_count"].as<unsigned long>());
+  TEST_ASSERT_TRUE(msgpack_bytes > 0 && msgpack_bytes < json_bytes);
+  printf("{\"message_sizes\":{\"count\":%lu,\"json_bytes\":%lu,\"msgpack_bytes\":%lu}}\n",
+         doc["message_count"].as<unsigned long>(), json_bytes, msgpack_bytes);
+}
+
+static void write_results() {
+  const char *filename = getenv("BENCH_ENCODING_OUTPUT");
+  if (!filename) {
+    filename = "bench_encoding.json";
+  }
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    printf("bench_encoding: unable to write %s\n", filename);
+    return;
+  }
+  fprintf(f, "{\"benchmark\":\"message_encoding\",\"results\":[\n");
+  for (size_t i=0; i<results.size(); i++) {
+    fprintf(f, "%s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  host_spiffs_format();
+  firmware_boot();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_token_auth);
+  RUN_TEST(test_token_auth_ntag);
+  RUN_TEST(test_state_info);
+  RUN_TEST(test_state_info_delta);
+  RUN_TEST(test_event_batch);
+  RUN_TEST(test_message_sizes);
+  write_results();
+  return UNITY_END();
+}
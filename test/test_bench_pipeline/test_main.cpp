@@ -0,0 +1,442 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// The whole card path through main.cpp: token_present, the token_auth
+// sent to a stand-in server, its token_info reply through
+// network_message_callback, then check_state driving the relay. Each
+// workload reports swipes per second of firmware time, the time from
+// presenting a card to the decision (on the firmware's clock, so it
+// includes the server's latency and any timeout) and the host time spent
+// in loop() per swipe, with percentiles.
+//
+// Heap is counted twice: allocations and bytes through operator new, and
+// glibc's view of the whole heap, sampled after every swipe, for the high
+// water mark and how much of the arena is free but held (fragmentation).
+// The host allocator isn't umm_malloc, so the fragmentation figure is
+// only indicative, and the stand-in NetThing allocates for each message
+// it carries; what carries over to the device is a change in these
+// numbers from one commit to the next.
+//
+//   pio test -e native -f test_bench_pipeline -v
+//
+// Results are printed as JSON and written to bench_pipeline.json, or to
+// $BENCH_PIPELINE_OUTPUT if it is set. $BENCH_PIPELINE_SOAK sets the
+// number of swipes in the soak, 100000 by default.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "FirmwareShim.h"
+#include "HostShim.h"
+#include "TokensFile.h"
+
+#define TOKENS "/tokens.dat"
+#define DECISION_TIMEOUT 10000
+
+// GCC sees free() on what operator new returned once these are inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static unsigned long heap_allocs = 0;
+static unsigned long heap_bytes = 0;
+
+void *operator new(size_t size) {
+  heap_allocs++;
+  heap_bytes += size;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+  free(p);
+}
+
+struct HeapInfo {
+  size_t in_use = 0;
+  size_t free = 0;
+};
+
+static HeapInfo heap_info() {
+  HeapInfo info;
+#ifdef __GLIBC__
+  struct mallinfo2 m = mallinfo2();
+  info.in_use = m.uordblks;
+  info.free = m.fordblks;
+#endif
+  return info;
+}
+
+// Answers token_auth after a fixed latency from a list of UIDs, leaving
+// every nth one unanswered so that the firmware times it out.
+class StandInServer {
+ private:
+  struct Reply {
+    unsigned long due;
+    std::string uid;
+    uint32_t seq;
+  };
+  std::deque<Reply> replies;
+  unsigned long requests = 0;
+
+ public:
+  std::map<std::string, const TestToken*> tokens;
+  unsigned long latency = 20;
+  unsigned int drop_every = 0;
+
+  void poll() {
+    for (const std::string &json : net.sent) {
+      if (json.find("\"cmd\":\"token_auth\"") == std::string::npos) {
+        continue;
+      }
+      requests++;
+      if (drop_every > 0 && requests % drop_every == 0) {
+        continue;
+      }
+      StaticJsonDocument<1024> obj;
+      deserializeJson(obj, json);
+      replies.push_back({ millis() + latency, obj["uid"].as<const char*>(), obj["seq"] });
+    }
+    net.sent.clear();
+
+    while (!replies.empty() && (long)(millis() - replies.front().due) >= 0) {
+      const Reply &reply = replies.front();
+      auto it = tokens.find(reply.uid);
+      StaticJsonDocument<256> info;
+      info["cmd"] = "token_info";
+      info["uid"] = reply.uid.c_str();
+      info["seq"] = reply.seq;
+      info["found"] = it != tokens.end();
+      if (it != tokens.end()) {
+        info["name"] = it->second->user.c_str();
+        info["access"] = it->second->access;
+      }
+      firmware_receive(info);
+      replies.pop_front();
+    }
+  }
+};
+
+struct Workload {
+  const char *name;
+  int version = 4;
+  size_t tokens = 1000;
+  unsigned long swipes = 1000;
+  unsigned long latency = 20;
+  unsigned int drop_every = 0;
+  // ms between one decision and the next card
+  unsigned long gap = 0;
+  unsigned int state_set_every = 0;
+};
+
+struct Result {
+  unsigned long swipes = 0;
+  unsigned long granted = 0;
+  unsigned long denied = 0;
+  unsigned long undecided = 0;
+  double firmware_us = 0;
+  std::vector<unsigned long> decision_ms;
+  std::vector<double> loop_us;
+  unsigned long allocs = 0;
+  unsigned long alloc_bytes = 0;
+  HeapInfo start;
+  HeapInfo end;
+  size_t peak = 0;
+};
+
+static std::vector<std::string> results;
+static StandInServer server;
+static double step_us = 0;
+
+static void step(unsigned long max_ms) {
+  server.poll();
+  auto start = std::chrono::steady_clock::now();
+  firmware_step(max_ms);
+  auto end = std::chrono::steady_clock::now();
+  step_us += std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// the grant and deny beeps, as opposed to the one for presenting a card
+static int decision(size_t from) {
+  for (size_t i=from; i<buzzer.beeps.size(); i++) {
+    if (buzzer.beeps[i].hz == 1000) {
+      return 1;
+    }
+    if (buzzer.beeps[i].hz == 256) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+template <typename T>
+static T percentile(std::vector<T> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t i = (size_t)(p / 100.0 * (values.size() - 1) + 0.5);
+  return values[i];
+}
+
+static Result run(const Workload &workload) {
+  SPIFFS.remove(TOKENS);
+  std::vector<TestToken> tokens = make_tokens(workload.tokens, 1);
+  std::vector<TestToken> absent = make_absent_tokens(workload.tokens / 10 + 1, 2);
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENS, workload.version, tokens));
+  firmware_reset();
+
+  server.tokens.clear();
+  for (const TestToken &token : tokens) {
+    server.tokens[uid_hex(token)] = &token;
+  }
+  server.latency = workload.latency;
+  server.drop_every = workload.drop_every;
+
+  // one card in ten isn't known at all
+  std::vector<std::string> uids;
+  srand(3);
+  for (unsigned long i=0; i<workload.swipes; i++) {
+    if (i % 10 == 9) {
+      uids.push_back(uid_hex(absent[rand() % absent.size()]));
+    } else {
+      uids.push_back(uid_hex(tokens[rand() % tokens.size()]));
+    }
+  }
+
+  // the samples are allocated up front, so as not to be counted as growth
+  Result result;
+  result.decision_ms.reserve(workload.swipes);
+  result.loop_us.reserve(workload.swipes);
+  result.start = heap_info();
+  result.peak = result.start.in_use;
+  unsigned long allocs = heap_allocs;
+  unsigned long bytes = heap_bytes;
+  bool remote = false;
+  step_us = 0;
+
+  for (unsigned long i=0; i<workload.swipes; i++) {
+    if (workload.state_set_every > 0 && i % workload.state_set_every == 0) {
+      remote = !remote;
+      net.host_receive(remote ? "{\"cmd\":\"state_set\",\"remote_active\":true}"
+                              : "{\"cmd\":\"state_set\",\"remote_active\":false}");
+    }
+    buzzer.beeps.clear();
+    double us = step_us;
+    unsigned long start = millis();
+    firmware_present(uids[i].c_str());
+    int decided = -1;
+    while (decided < 0 && millis() - start < DECISION_TIMEOUT) {
+      step(1);
+      decided = decision(0);
+    }
+    result.swipes++;
+    if (decided < 0) {
+      result.undecided++;
+    } else {
+      (decided ? result.granted : result.denied)++;
+      result.decision_ms.push_back(millis() - start);
+    }
+    result.loop_us.push_back(step_us - us);
+
+    unsigned long gap = millis() + workload.gap;
+    while ((long)(millis() - gap) < 0) {
+      step(gap - millis());
+    }
+    HeapInfo heap = heap_info();
+    if (heap.in_use > result.peak) {
+      result.peak = heap.in_use;
+    }
+  }
+
+  result.firmware_us = step_us;
+  result.allocs = heap_allocs - allocs;
+  result.alloc_bytes = heap_bytes - bytes;
+  result.end = heap_info();
+  // let anything still pending time out before the next workload
+  firmware_run(DECISION_TIMEOUT);
+  net.sent.clear();
+  return result;
+}
+
+static void report(const Workload &workload, const Result &result) {
+  char buffer[1024];
+  double fragmentation = result.end.in_use + result.end.free > 0
+      ? 100.0 * result.end.free / (result.end.in_use + result.end.free) : 0;
+  snprintf(buffer, sizeof(buffer),
+           "{\"workload\":\"%s\",\"version\":%d,\"tokens\":%lu,\"swipes\":%lu,"
+           "\"granted\":%lu,\"denied\":%lu,\"undecided\":%lu,"
+           "\"server_latency_ms\":%lu,\"server_drop_every\":%u,\"state_set_every\":%u,"
+           "\"swipes_per_sec\":%.0f,"
+           "\"decision_ms\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu},"
+           "\"loop_us\":{\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f},"
+           "\"heap\":{\"allocs_per_swipe\":%.2f,\"bytes_per_swipe\":%.1f,"
+           "\"in_use_start\":%lu,\"in_use_end\":%lu,\"in_use_peak\":%lu,"
+           "\"fragmentation_pct\":%.1f}}",
+           workload.name, workload.version, (unsigned long)workload.tokens, result.swipes,
+           result.granted, result.denied, result.undecided,
+           workload.latency, workload.drop_every, workload.state_set_every,
+           result.firmware_us > 0 ? result.swipes * 1e6 / result.firmware_us : 0,
+           percentile(result.decision_ms, 50), percentile(result.decision_ms, 90),
+           percentile(result.decision_ms, 99), percentile(result.decision_ms, 100),
+           percentile(result.loop_us, 50), percentile(result.loop_us, 90),
+           percentile(result.loop_us, 99), percentile(result.loop_us, 100),
+           (double)result.allocs / result.swipes, (double)result.alloc_bytes / result.swipes,
+           (unsigned long)result.start.in_use, (unsigned long)result.end.in_use,
+           (unsigned long)result.peak, fragmentation);
+  results.push_back(buffer);
+  printf("%s\n", buffer);
+}
+
+static Result bench(const Workload &workload) {
+  Result result = run(workload);
+  report(workload, result);
+  TEST_ASSERT_EQUAL(0, result.undecided);
+  return result;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_burst() {
+  Workload workload;
+  workload.name = "burst";
+  workload.swipes = 2000;
+  Result result = bench(workload);
+  // the server's latency, and a pass or two either side of it
+  unsigned long p50 = percentile(result.decision_ms, 50);
+  TEST_ASSERT_GREATER_OR_EQUAL(workload.latency, p50);
+  TEST_ASSERT_LESS_OR_EQUAL(workload.latency + 5, p50);
+}
+
+void test_timeouts() {
+  Workload workload;
+  workload.name = "timeouts";
+  workload.swipes = 500;
+  workload.drop_every = 5;
+  bench(workload);
+}
+
+void test_state_set() {
+  Workload workload;
+  workload.name = "state_set";
+  workload.swipes = 2000;
+  workload.gap = 100;
+  workload.state_set_every = 3;
+  bench(workload);
+}
+
+// the server is down, so every card is looked up in tokens.dat
+static void offline(int version) {
+  Workload workload;
+  workload.name = "offline";
+  workload.version = version;
+  workload.tokens = 10000;
+  workload.swipes = 100;
+  workload.drop_every = 1;
+  bench(workload);
+}
+
+void test_offline_v1() {
+  offline(1);
+}
+
+void test_offline_v2() {
+  offline(2);
+}
+
+void test_offline_v3() {
+  offline(3);
+}
+
+void test_offline_v4() {
+  offline(4);
+}
+
+// Heap in use after a long run of swipes, with some timeouts and state
+// changes among them, should be where it was after the first few, give or
+// take the messages and lookups that happen to be in flight at either end.
+void test_soak() {
+  const char *swipes = getenv("BENCH_PIPELINE_SOAK");
+  Workload warmup;
+  warmup.name = "soak_warmup";
+  warmup.swipes = 1000;
+  warmup.drop_every = 50;
+  warmup.state_set_every = 10;
+  Workload workload = warmup;
+  workload.name = "soak";
+  workload.swipes = swipes ? strtoul(swipes, NULL, 10) : 100000;
+  bench(warmup);
+  Result result = bench(workload);
+  TEST_ASSERT_TRUE(result.end.in_use <= result.start.in_use + 4096);
+}
+
+static void write_results() {
+  const char *filename = getenv("BENCH_PIPELINE_OUTPUT");
+  if (!filename) {
+    filename = "bench_pipeline.json";
+  }
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    printf("bench_pipeline: unable to write %s\n", filename);
+    return;
+  }
+  fprintf(f, "{\"benchmark\":\"auth_pipeline\",\"results\":[\n");
+  for (size_t i=0; i<results.size(); i++) {
+    fprintf(f, "%s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  host_spiffs_format();
+  firmware_boot();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_burst);
+  RUN_TEST(test_timeouts);
+  RUN_TEST(test_state_set);
+  RUN_TEST(test_offline_v1);
+  RUN_TEST(test_offline_v2);
+  RUN_TEST(test_offline_v3);
+  RUN_TEST(test_offline_v4);
+  RUN_TEST(test_soak);
+  write_results();
+  return UNITY_END();
+}
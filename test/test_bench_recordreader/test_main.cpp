@@ -0,0 +1,298 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Flash reads per lookup in v1-v3 tokens.dat files, before and after the
+// parsers moved onto RecordReader. "before" is the parser TokenDB had
+// until then, a File::read() per byte and a readBytes() per field, kept
+// here as it was; "after" is TokenDB itself with the index turned off, so
+// that every lookup is a scan. Each read is a SPIFFS call on the device,
+// so read calls are the figure to watch; host time is only for comparing
+// one build with another.
+//
+//   pio test -e native -f test_bench_recordreader -v
+//
+// Results are printed as JSON and written to bench_recordreader.json, or
+// to $BENCH_RECORDREADER_OUTPUT if it is set.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <MD5Builder.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "HostShim.h"
+#include "TokensFile.h"
+#include "app_util.h"
+#include "tokendb.hpp"
+
+#define TOKENS "/tokens.dat"
+#define JOURNAL "/tokens.jnl"
+#define SAMPLES 50
+
+static const size_t sizes[] = {100, 1000, 3000};
+
+struct Cost {
+  unsigned long lookups = 0;
+  unsigned long read_calls = 0;
+  unsigned long read_bytes = 0;
+  double us = 0;
+};
+
+static std::vector<std::string> results;
+
+// A File that counts the calls that reach SPIFFS. readBytes() is one
+// call, as it is in the ESP8266 core's File.
+class CountingFile {
+ private:
+  File file;
+
+ public:
+  unsigned long read_calls = 0;
+  unsigned long read_bytes = 0;
+  CountingFile(File f) : file(f) {}
+  int available() { return file.available(); }
+  int read() {
+    read_calls++;
+    int c = file.read();
+    read_bytes += c >= 0;
+    return c;
+  }
+  size_t readBytes(char *buffer, size_t length) {
+    read_calls++;
+    size_t count = file.read((uint8_t*)buffer, length);
+    read_bytes += count;
+    return count;
+  }
+  void close() { file.close(); }
+};
+
+// TokenDB::query_v1() to query_v3() before RecordReader, less the logging
+static bool before_v1(CountingFile &file, uint8_t uidlen, uint8_t *uid) {
+  while (file.available()) {
+    uint8_t xlen = file.read();
+    uint8_t xuid[xlen];
+    for (int i=0; i<xlen; i++) {
+      xuid[i] = file.read();
+    }
+    if ((xlen == uidlen) && (memcmp(xuid, uid, xlen) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool before_v2(CountingFile &file, uint8_t uidlen, uint8_t *uid) {
+  int hash_bytes = file.read();
+  int salt_length = file.read();
+  char salt[salt_length+1];
+
+  if (salt_length > 0) {
+    for (int i=0; i<salt_length; i++) {
+      salt[i] = file.read();
+    }
+    salt[salt_length] = 0;
+  } else {
+    salt[0] = 0;
+  }
+
+  uint8_t hash[16];
+
+  MD5Builder md5;
+  md5.begin();
+  md5.add((uint8_t*)salt, salt_length);
+  md5.add(uid, uidlen);
+  md5.calculate();
+  md5.getBytes(hash);
+
+  while (file.available()) {
+    uint8_t hashed_uid[hash_bytes];
+    uint8_t access;
+    uint8_t user_length;
+    file.readBytes((char*)hashed_uid, hash_bytes);
+    access = file.read();
+    user_length = file.read();
+    char new_user[user_length+1];
+    file.readBytes(new_user, user_length);
+    new_user[user_length] = 0;
+    if (memcmp(hash, hashed_uid, hash_bytes) == 0) {
+      return access > 0;
+    }
+  }
+  return false;
+}
+
+static bool before_v3(CountingFile &file, uint8_t uidlen, uint8_t *uid) {
+  while (file.available()) {
+    uint8_t xuidlen = file.read();
+    uint8_t xuid[xuidlen];
+    file.readBytes((char*)xuid, xuidlen);
+    uint8_t user_length = file.read();
+    char new_user[user_length+1];
+    file.readBytes(new_user, user_length);
+    new_user[user_length] = 0;
+    if ((xuidlen == uidlen) && (memcmp(xuid, uid, xuidlen) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool before_lookup(const char *uid, Cost &cost) {
+  uint8_t uidbytes[10];
+  uint8_t uidlen = decode_hex(uid, uidbytes, sizeof(uidbytes));
+  CountingFile file(SPIFFS.open(TOKENS, "r"));
+  bool found = false;
+  switch (file.read()) {
+    case 1:
+      found = before_v1(file, uidlen, uidbytes);
+      break;
+    case 2:
+      found = before_v2(file, uidlen, uidbytes);
+      break;
+    case 3:
+      found = before_v3(file, uidlen, uidbytes);
+      break;
+  }
+  file.close();
+  cost.read_calls += file.read_calls;
+  cost.read_bytes += file.read_bytes;
+  return found;
+}
+
+// granted tokens spread through the file
+static std::vector<TestToken> sample(const std::vector<TestToken> &tokens) {
+  std::vector<TestToken> granted;
+  for (const TestToken &token : tokens) {
+    if (token.access > 0) {
+      granted.push_back(token);
+    }
+  }
+  std::vector<TestToken> out;
+  size_t step = granted.size() > SAMPLES ? granted.size() / SAMPLES : 1;
+  for (size_t i=0; i<granted.size() && out.size() < SAMPLES; i+=step) {
+    out.push_back(granted[i]);
+  }
+  return out;
+}
+
+static Cost measure_before(const std::vector<TestToken> &tokens, bool expected) {
+  Cost cost;
+  auto start = std::chrono::steady_clock::now();
+  for (const TestToken &token : tokens) {
+    std::string uid = uid_hex(token);
+    TEST_ASSERT_EQUAL_MESSAGE(expected, before_lookup(uid.c_str(), cost), uid.c_str());
+  }
+  auto end = std::chrono::steady_clock::now();
+  cost.lookups = tokens.size();
+  cost.us = std::chrono::duration<double, std::micro>(end - start).count();
+  return cost;
+}
+
+static Cost measure_after(const std::vector<TestToken> &tokens, bool expected) {
+  TokenDB db(TOKENS, JOURNAL);
+  db.set_index_max_bytes(0);
+  // the header is read once and kept
+  db.lookup(uid_hex(tokens[0]).c_str());
+  Cost cost;
+  uint32_t calls = db.get_read_calls();
+  uint32_t bytes = db.get_read_bytes();
+  auto start = std::chrono::steady_clock::now();
+  for (const TestToken &token : tokens) {
+    std::string uid = uid_hex(token);
+    TEST_ASSERT_EQUAL_MESSAGE(expected, db.lookup(uid.c_str()), uid.c_str());
+  }
+  auto end = std::chrono::steady_clock::now();
+  cost.lookups = tokens.size();
+  cost.read_calls = db.get_read_calls() - calls;
+  cost.read_bytes = db.get_read_bytes() - bytes;
+  cost.us = std::chrono::duration<double, std::micro>(end - start).count();
+  return cost;
+}
+
+static std::string cost_json(const Cost &cost) {
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer),
+           "{\"lookups\":%lu,\"read_calls\":%.1f,\"read_bytes\":%.1f,\"us\":%.2f}",
+           cost.lookups,
+           (double)cost.read_calls / cost.lookups,
+           (double)cost.read_bytes / cost.lookups,
+           cost.us / cost.lookups);
+  return buffer;
+}
+
+static void bench(int version) {
+  for (size_t count : sizes) {
+    SPIFFS.format();
+    std::vector<TestToken> tokens = make_tokens(count, 1);
+    std::vector<TestToken> present = sample(tokens);
+    std::vector<TestToken> absent = make_absent_tokens(present.size(), 2);
+    TEST_ASSERT_TRUE(write_tokens_file(TOKENS, version, tokens));
+
+    Cost before_hit = measure_before(present, true);
+    Cost before_miss = measure_before(absent, false);
+    Cost after_hit = measure_after(present, true);
+    Cost after_miss = measure_after(absent, false);
+    // a scan now reads blocks rather than bytes and fields
+    TEST_ASSERT_TRUE(after_miss.read_calls * 10 < before_miss.read_calls);
+
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "{\"version\":%d,\"tokens\":%lu,",
+             version, (unsigned long)count);
+    std::string result = buffer;
+    result += "\"before\":{\"present\":" + cost_json(before_hit);
+    result += ",\"absent\":" + cost_json(before_miss) + "}";
+    result += ",\"after\":{\"present\":" + cost_json(after_hit);
+    result += ",\"absent\":" + cost_json(after_miss) + "}}";
+    results.push_back(result);
+    printf("%s\n", result.c_str());
+  }
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_v1() {
+  bench(1);
+}
+
+void test_v2() {
+  bench(2);
+}
+
+void test_v3() {
+  bench(3);
+}
+
+static void write_results() {
+  const char *filename = getenv("BENCH_RECORDREADER_OUTPUT");
+  if (!filename) {
+    filename = "bench_recordreader.json";
+  }
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    printf("bench_recordreader: unable to write %s\n", filename);
+    return;
+  }
+  fprintf(f, "{\"benchmark\":\"tokendb_scan_reads\",\"results\":[\n");
+  for (size_t i=0; i<results.size(); i++) {
+    fprintf(f, "%s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_v1);
+  RUN_TEST(test_v2);
+  RUN_TEST(test_v3);
+  write_results();
+  return UNITY_END();
+}
@@ -0,0 +1,187 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// TokenDB lookup cost against database size, for each file format with and
+// without the in-RAM index. Read calls and bytes per lookup are what
+// matter on the device, where each read is a SPIFFS access; host time is
+// only for comparing one build with another.
+//
+//   pio test -e native -f test_bench_tokendb -v
+//
+// Results are printed as JSON and written to bench_tokendb.json, or to
+// $BENCH_TOKENDB_OUTPUT if it is set.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "HostShim.h"
+#include "TokensFile.h"
+#include "tokendb.hpp"
+
+#define TOKENS "/tokens.dat"
+#define JOURNAL "/tokens.jnl"
+#define SAMPLES 200
+
+static const size_t sizes[] = {100, 1000, 3000, 10000};
+
+struct Cost {
+  unsigned long lookups = 0;
+  unsigned long read_calls = 0;
+  unsigned long read_bytes = 0;
+  double us = 0;
+};
+
+static std::vector<std::string> results;
+
+// granted tokens spread through the file
+static std::vector<TestToken> sample(const std::vector<TestToken> &tokens) {
+  std::vector<TestToken> granted;
+  for (const TestToken &token : tokens) {
+    if (token.access > 0) {
+      granted.push_back(token);
+    }
+  }
+  std::vector<TestToken> out;
+  size_t step = granted.size() > SAMPLES ? granted.size() / SAMPLES : 1;
+  for (size_t i=0; i<granted.size() && out.size() < SAMPLES; i+=step) {
+    out.push_back(granted[i]);
+  }
+  return out;
+}
+
+static Cost measure(TokenDB &db, const std::vector<TestToken> &tokens, bool expected) {
+  Cost cost;
+  uint32_t calls = db.get_read_calls();
+  uint32_t bytes = db.get_read_bytes();
+  auto start = std::chrono::steady_clock::now();
+  for (const TestToken &token : tokens) {
+    std::string uid = uid_hex(token);
+    bool found = db.lookup(uid.c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(expected, found, uid.c_str());
+  }
+  auto end = std::chrono::steady_clock::now();
+  cost.lookups = tokens.size();
+  cost.read_calls = db.get_read_calls() - calls;
+  cost.read_bytes = db.get_read_bytes() - bytes;
+  cost.us = std::chrono::duration<double, std::micro>(end - start).count();
+  return cost;
+}
+
+static std::string cost_json(const Cost &cost) {
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer),
+           "{\"lookups\":%lu,\"read_calls\":%.2f,\"read_bytes\":%.1f,\"us\":%.2f}",
+           cost.lookups,
+           (double)cost.read_calls / cost.lookups,
+           (double)cost.read_bytes / cost.lookups,
+           cost.us / cost.lookups);
+  return buffer;
+}
+
+static void bench(int version, bool hashed, size_t index_bytes) {
+  for (size_t count : sizes) {
+    SPIFFS.format();
+    std::vector<TestToken> tokens = make_tokens(count, 1);
+    std::vector<TestToken> present = sample(tokens);
+    std::vector<TestToken> absent = make_absent_tokens(present.size(), 2);
+    TEST_ASSERT_TRUE(write_tokens_file(TOKENS, version, tokens, hashed));
+    File file = SPIFFS.open(TOKENS, "r");
+    size_t file_bytes = file.size();
+    file.close();
+
+    TokenDB db(TOKENS, JOURNAL);
+    db.set_index_max_bytes(index_bytes);
+    // the first lookup reads the header and builds the index, if any
+    Cost first = measure(db, std::vector<TestToken>(1, present[0]), true);
+    Cost hit = measure(db, present, true);
+    Cost miss = measure(db, absent, false);
+
+    char buffer[160];
+    snprintf(buffer, sizeof(buffer),
+             "{\"version\":%d,\"hashed\":%s,\"index_max_bytes\":%lu,\"tokens\":%lu,\"file_bytes\":%lu,",
+             version, hashed ? "true" : "false", (unsigned long)index_bytes,
+             (unsigned long)count, (unsigned long)file_bytes);
+    std::string result = buffer;
+    result += "\"first\":" + cost_json(first);
+    result += ",\"present\":" + cost_json(hit);
+    result += ",\"absent\":" + cost_json(miss) + "}";
+    results.push_back(result);
+    printf("%s\n", result.c_str());
+  }
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_v1_scan() {
+  bench(1, false, 0);
+}
+
+void test_v1_indexed() {
+  bench(1, false, 8192);
+}
+
+void test_v2_scan() {
+  bench(2, false, 0);
+}
+
+void test_v2_indexed() {
+  bench(2, false, 8192);
+}
+
+void test_v3_scan() {
+  bench(3, false, 0);
+}
+
+void test_v3_indexed() {
+  bench(3, false, 8192);
+}
+
+void test_v4_sorted() {
+  bench(4, false, 0);
+}
+
+void test_v4_sorted_hashed() {
+  bench(4, true, 0);
+}
+
+static void write_results() {
+  const char *filename = getenv("BENCH_TOKENDB_OUTPUT");
+  if (!filename) {
+    filename = "bench_tokendb.json";
+  }
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    printf("bench_tokendb: unable to write %s\n", filename);
+    return;
+  }
+  fprintf(f, "{\"benchmark\":\"tokendb_lookup\",\"results\":[\n");
+  for (size_t i=0; i<results.size(); i++) {
+    fprintf(f, "%s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_v1_scan);
+  RUN_TEST(test_v1_indexed);
+  RUN_TEST(test_v2_scan);
+  RUN_TEST(test_v2_indexed);
+  RUN_TEST(test_v3_scan);
+  RUN_TEST(test_v3_indexed);
+  RUN_TEST(test_v4_sorted);
+  RUN_TEST(test_v4_sorted_hashed);
+  write_results();
+  return UNITY_END();
+}
@@ -0,0 +1,315 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// CommandTable lookups, and what a dispatch costs against the chain of
+// String comparisons that network_message_callback used before it, for
+// the same commands in the same order. The timings are printed as JSON
+// and are only for comparing one build with another.
+//
+//   pio test -e native -f test_commandtable -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "CommandTable.hpp"
+#include "FirmwareShim.h"
+#include "HostShim.h"
+
+#define DISPATCHES 100000
+
+// as register_commands() in main.cpp
+static const char *registered[] = {
+  "buzzer_beep",
+  "buzzer_chirp",
+  "buzzer_click",
+  "buzzer_tune",
+  "metrics_query",
+#ifdef LOOP_PROFILER
+  "profile_query",
+  "profile_reset",
+#endif
+  "state_query",
+  "state_set",
+  "token_info",
+  "token_update",
+  "trace_clear",
+  "trace_query",
+  "trace_start",
+  "trace_stop",
+};
+#define REGISTERED (sizeof(registered) / sizeof(registered[0]))
+
+static const char *unknown[] = {
+  "",
+  "state",
+  "state_set_",
+  "State_set",
+  "token_auth",
+  "no_such_command",
+};
+
+static int calls[COMMANDTABLE_SIZE];
+static int last;
+
+template <int N>
+static void handler(const JsonDocument &obj) {
+  calls[N]++;
+  last = N;
+}
+
+static const command_handler_t handlers[] = {
+  handler<0>, handler<1>, handler<2>, handler<3>,
+  handler<4>, handler<5>, handler<6>, handler<7>,
+  handler<8>, handler<9>, handler<10>, handler<11>,
+  handler<12>, handler<13>, handler<14>, handler<15>,
+  handler<16>, handler<17>, handler<18>, handler<19>,
+  handler<20>, handler<21>, handler<22>, handler<23>,
+  handler<24>, handler<25>, handler<26>, handler<27>,
+  handler<28>, handler<29>, handler<30>, handler<31>,
+};
+
+static void add_registered(CommandTable &table) {
+  for (size_t i=0; i<REGISTERED; i++) {
+    TEST_ASSERT_TRUE(table.add(command_hash(registered[i]), registered[i], handlers[i]));
+  }
+}
+
+// names that land in the same slot as the given one
+static std::vector<std::string> same_slot(const char *name, size_t count) {
+  std::vector<std::string> out;
+  uint32_t slot = command_hash(name) % COMMANDTABLE_SIZE;
+  char candidate[16];
+  for (int i=0; out.size() < count; i++) {
+    snprintf(candidate, sizeof(candidate), "cmd_%d", i);
+    if (command_hash(candidate) % COMMANDTABLE_SIZE == slot) {
+      out.push_back(candidate);
+    }
+  }
+  return out;
+}
+
+static bool dispatch(CommandTable &table, const char *name) {
+  StaticJsonDocument<64> obj;
+  obj["cmd"] = name;
+  last = -1;
+  return table.dispatch(obj["cmd"], obj);
+}
+
+void setUp() {
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    calls[i] = 0;
+  }
+}
+
+void tearDown() {
+}
+
+void test_hash_is_fnv1a() {
+  TEST_ASSERT_EQUAL_UINT32(2166136261u, command_hash(""));
+  TEST_ASSERT_EQUAL_UINT32(0xe40c292cu, command_hash("a"));
+  TEST_ASSERT_EQUAL_UINT32(0xbf9cf968u, command_hash("foobar"));
+}
+
+void test_every_command_hits() {
+  CommandTable table;
+  add_registered(table);
+  for (size_t i=0; i<REGISTERED; i++) {
+    TEST_ASSERT_TRUE_MESSAGE(dispatch(table, registered[i]), registered[i]);
+    TEST_ASSERT_EQUAL_MESSAGE(i, last, registered[i]);
+  }
+  for (size_t i=0; i<REGISTERED; i++) {
+    TEST_ASSERT_EQUAL(1, calls[i]);
+  }
+}
+
+void test_unknown_misses() {
+  CommandTable table;
+  add_registered(table);
+  for (const char *name : unknown) {
+    TEST_ASSERT_FALSE_MESSAGE(dispatch(table, name), name);
+  }
+  TEST_ASSERT_FALSE(table.dispatch(NULL, StaticJsonDocument<16>()));
+  for (size_t i=0; i<REGISTERED; i++) {
+    TEST_ASSERT_EQUAL(0, calls[i]);
+  }
+}
+
+// commands sharing a slot are probed past in turn, and a miss that shares
+// the slot carries on to the first empty one
+void test_same_slot_probes() {
+  std::vector<std::string> names = same_slot("state_set", 4);
+  CommandTable table;
+  add_registered(table);
+  for (size_t i=0; i<names.size() - 1; i++) {
+    TEST_ASSERT_TRUE(table.add(command_hash(names[i].c_str()), names[i].c_str(), handlers[REGISTERED + i]));
+  }
+  for (size_t i=0; i<names.size() - 1; i++) {
+    TEST_ASSERT_TRUE(dispatch(table, names[i].c_str()));
+    TEST_ASSERT_EQUAL(REGISTERED + i, last);
+  }
+  TEST_ASSERT_TRUE(dispatch(table, "state_set"));
+  TEST_ASSERT_FALSE(dispatch(table, names.back().c_str()));
+}
+
+// an entry with the same full hash but another name is not a match
+void test_same_hash_other_name() {
+  CommandTable table;
+  TEST_ASSERT_TRUE(table.add(command_hash("state_set"), "state_sex", handlers[0]));
+  TEST_ASSERT_TRUE(table.add(command_hash("state_set"), "state_set", handlers[1]));
+  TEST_ASSERT_TRUE(dispatch(table, "state_set"));
+  TEST_ASSERT_EQUAL(1, last);
+  TEST_ASSERT_FALSE(dispatch(table, "state_sex"));
+}
+
+// adding a name again replaces its handler rather than taking a slot
+void test_add_replaces() {
+  CommandTable table;
+  add_registered(table);
+  TEST_ASSERT_TRUE(table.add(COMMAND("state_set"), handlers[31]));
+  TEST_ASSERT_TRUE(dispatch(table, "state_set"));
+  TEST_ASSERT_EQUAL(31, last);
+}
+
+// a full table refuses more, and a miss still stops
+void test_full() {
+  std::vector<std::string> names;
+  char name[16];
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    snprintf(name, sizeof(name), "cmd_%d", i);
+    names.push_back(name);
+  }
+  CommandTable table;
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    TEST_ASSERT_TRUE(table.add(command_hash(names[i].c_str()), names[i].c_str(), handlers[i]));
+  }
+  TEST_ASSERT_FALSE(table.add(COMMAND("state_set"), handlers[0]));
+  for (int i=0; i<COMMANDTABLE_SIZE; i++) {
+    TEST_ASSERT_TRUE(dispatch(table, names[i].c_str()));
+    TEST_ASSERT_EQUAL(i, last);
+  }
+  TEST_ASSERT_FALSE(dispatch(table, "state_set"));
+}
+
+// the table main.cpp builds answers every command it registers (with a
+// short tune for buzzer_tune, which needs one)
+void test_firmware_commands() {
+  firmware_boot();
+  for (size_t i=0; i<REGISTERED; i++) {
+    firmware_clear_sent();
+    StaticJsonDocument<64> obj;
+    obj["cmd"] = registered[i];
+    obj["data"] = "AAAAAA==";
+    firmware_receive(obj);
+    firmware_run(10);
+    StaticJsonDocument<256> error;
+    TEST_ASSERT_FALSE_MESSAGE(firmware_sent("error", error), registered[i]);
+  }
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"token_auth\"}");
+  firmware_run(10);
+  StaticJsonDocument<256> error;
+  TEST_ASSERT_TRUE(firmware_sent("error", error));
+}
+
+// network_message_callback before the table
+static bool chain_dispatch(const JsonDocument &obj) {
+  String cmd = obj["cmd"];
+
+  if (cmd == "buzzer_beep") {
+    handler<0>(obj);
+  } else if (cmd == "buzzer_chirp") {
+    handler<1>(obj);
+  } else if (cmd == "buzzer_click") {
+    handler<2>(obj);
+  } else if (cmd == "buzzer_tune") {
+    handler<3>(obj);
+  } else if (cmd == "metrics_query") {
+    handler<4>(obj);
+  } else if (cmd == "profile_query") {
+    handler<5>(obj);
+  } else if (cmd == "profile_reset") {
+    handler<6>(obj);
+  } else if (cmd == "state_query") {
+    handler<7>(obj);
+  } else if (cmd == "state_set") {
+    handler<8>(obj);
+  } else if (cmd == "token_info") {
+    handler<9>(obj);
+  } else if (cmd == "token_update") {
+    handler<10>(obj);
+  } else if (cmd == "trace_clear") {
+    handler<11>(obj);
+  } else if (cmd == "trace_query") {
+    handler<12>(obj);
+  } else if (cmd == "trace_start") {
+    handler<13>(obj);
+  } else if (cmd == "trace_stop") {
+    handler<14>(obj);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const char *chain_names[] = {
+  "buzzer_beep", "buzzer_chirp", "buzzer_click", "buzzer_tune",
+  "metrics_query", "profile_query", "profile_reset", "state_query",
+  "state_set", "token_info", "token_update", "trace_clear",
+  "trace_query", "trace_start", "trace_stop",
+};
+
+template <typename F>
+static double ns_per_dispatch(const JsonDocument &obj, F dispatch) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<DISPATCHES; i++) {
+    dispatch(obj);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / DISPATCHES;
+}
+
+static void bench_one(CommandTable &table, const char *name) {
+  StaticJsonDocument<64> obj;
+  obj["cmd"] = name;
+  bool in_table = dispatch(table, name);
+  bool in_chain = chain_dispatch(obj);
+  TEST_ASSERT_EQUAL_MESSAGE(in_chain, in_table, name);
+
+  double table_ns = ns_per_dispatch(obj, [&table](const JsonDocument &obj) {
+    table.dispatch(obj["cmd"], obj);
+  });
+  double chain_ns = ns_per_dispatch(obj, chain_dispatch);
+  printf("{\"cmd\":\"%s\",\"found\":%s,\"table_ns\":%.1f,\"chain_ns\":%.1f}\n",
+         name, in_table ? "true" : "false", table_ns, chain_ns);
+}
+
+void test_dispatch_cost() {
+  CommandTable table;
+  for (size_t i=0; i<sizeof(chain_names) / sizeof(chain_names[0]); i++) {
+    TEST_ASSERT_TRUE(table.add(command_hash(chain_names[i]), chain_names[i], handlers[i]));
+  }
+  for (const char *name : chain_names) {
+    bench_one(table, name);
+  }
+  bench_one(table, "no_such_command");
+}
+
+int main(int argc, char **argv) {
+  host_spiffs_format();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_hash_is_fnv1a);
+  RUN_TEST(test_every_command_hits);
+  RUN_TEST(test_unknown_misses);
+  RUN_TEST(test_same_slot_probes);
+  RUN_TEST(test_same_hash_other_name);
+  RUN_TEST(test_add_replaces);
+  RUN_TEST(test_full);
+  RUN_TEST(test_firmware_commands);
+  RUN_TEST(test_dispatch_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,182 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <stdio.h>
+#include <unity.h>
+#include "DoorMachine.hpp"
+
+// The unlock flags and their handling as written in main.cpp before the
+// door machine, used as the reference for every transition.
+struct Baseline {
+  bool card_active;
+  bool exit_active;
+  bool snib_active;
+  bool remote_active;
+
+  explicit Baseline(uint8_t mask)
+    : card_active(mask & DOOR_CARD), exit_active(mask & DOOR_EXIT),
+      snib_active(mask & DOOR_SNIB), remote_active(mask & DOOR_REMOTE) {}
+
+  uint8_t mask() const {
+    return (card_active ? DOOR_CARD : 0) | (exit_active ? DOOR_EXIT : 0)
+      | (snib_active ? DOOR_SNIB : 0) | (remote_active ? DOOR_REMOTE : 0);
+  }
+
+  void apply(DoorMachine::event_t event) {
+    switch (event) {
+      case DoorMachine::card_grant:
+        card_active = true;
+        break;
+      case DoorMachine::card_end:
+        card_active = false;
+        break;
+      case DoorMachine::exit_request:
+        exit_active = true;
+        break;
+      case DoorMachine::exit_end:
+        exit_active = false;
+        break;
+      case DoorMachine::snib_on:
+        snib_active = true;
+        break;
+      case DoorMachine::snib_off:
+        snib_active = false;
+        break;
+      case DoorMachine::exit_hold_snib_on:
+        snib_active = true;
+        exit_active = false;
+        break;
+      case DoorMachine::exit_hold_snib_off:
+        snib_active = false;
+        exit_active = false;
+        break;
+      case DoorMachine::remote_on:
+        remote_active = true;
+        break;
+      case DoorMachine::remote_off:
+        remote_active = false;
+        break;
+      case DoorMachine::door_open_anti_bounce:
+        if (exit_active) {
+          exit_active = false;
+        }
+        if (card_active) {
+          card_active = false;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  DoorMachine::led_t led(bool on_battery, bool network_up) const {
+    if (card_active || exit_active) {
+      return DoorMachine::led_flash_fast;
+    } else if (snib_active || remote_active) {
+      return DoorMachine::led_flash_medium;
+    } else if (on_battery) {
+      return DoorMachine::led_dim;
+    } else if (network_up == false) {
+      return DoorMachine::led_blink;
+    } else {
+      return DoorMachine::led_on;
+    }
+  }
+};
+
+// the machine has no setter, so build each state from a fresh one
+static DoorMachine machine_in(uint8_t mask) {
+  DoorMachine machine;
+  if (mask & DOOR_CARD) machine.fire(DoorMachine::card_grant);
+  if (mask & DOOR_EXIT) machine.fire(DoorMachine::exit_request);
+  if (mask & DOOR_SNIB) machine.fire(DoorMachine::snib_on);
+  if (mask & DOOR_REMOTE) machine.fire(DoorMachine::remote_on);
+  return machine;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_starts_locked() {
+  DoorMachine machine;
+  TEST_ASSERT_EQUAL(0, machine.get_active());
+  TEST_ASSERT_FALSE(machine.relay());
+}
+
+void test_reach_every_state() {
+  for (uint8_t mask=0; mask<16; mask++) {
+    TEST_ASSERT_EQUAL(mask, machine_in(mask).get_active());
+  }
+}
+
+void test_transitions() {
+  char message[64];
+  for (uint8_t mask=0; mask<16; mask++) {
+    for (int event=0; event<DoorMachine::event_count; event++) {
+      snprintf(message, sizeof(message), "state %u event %d", mask, event);
+      Baseline expected(mask);
+      expected.apply((DoorMachine::event_t)event);
+      DoorMachine machine = machine_in(mask);
+      bool changed = machine.fire((DoorMachine::event_t)event);
+      TEST_ASSERT_EQUAL_MESSAGE(expected.mask(), machine.get_active(), message);
+      TEST_ASSERT_EQUAL_MESSAGE(expected.mask() != mask, changed, message);
+    }
+  }
+}
+
+void test_is_active() {
+  for (uint8_t mask=0; mask<16; mask++) {
+    DoorMachine machine = machine_in(mask);
+    Baseline expected(mask);
+    TEST_ASSERT_EQUAL(expected.card_active, machine.is_active(DOOR_CARD));
+    TEST_ASSERT_EQUAL(expected.exit_active, machine.is_active(DOOR_EXIT));
+    TEST_ASSERT_EQUAL(expected.snib_active, machine.is_active(DOOR_SNIB));
+    TEST_ASSERT_EQUAL(expected.remote_active, machine.is_active(DOOR_REMOTE));
+  }
+}
+
+void test_relay() {
+  for (uint8_t mask=0; mask<16; mask++) {
+    TEST_ASSERT_EQUAL(mask != 0, machine_in(mask).relay());
+  }
+}
+
+void test_leds() {
+  char message[64];
+  for (uint8_t mask=0; mask<16; mask++) {
+    for (int on_battery=0; on_battery<2; on_battery++) {
+      for (int network_up=0; network_up<2; network_up++) {
+        snprintf(message, sizeof(message), "state %u battery %d network %d",
+          mask, on_battery, network_up);
+        Baseline expected(mask);
+        DoorMachine machine = machine_in(mask);
+        TEST_ASSERT_EQUAL_MESSAGE(expected.led(on_battery, network_up),
+          machine.led(on_battery, network_up), message);
+      }
+    }
+  }
+}
+
+void test_out_of_range_event_ignored() {
+  for (uint8_t mask=0; mask<16; mask++) {
+    DoorMachine machine = machine_in(mask);
+    TEST_ASSERT_FALSE(machine.fire(DoorMachine::event_count));
+    TEST_ASSERT_EQUAL(mask, machine.get_active());
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_starts_locked);
+  RUN_TEST(test_reach_every_state);
+  RUN_TEST(test_transitions);
+  RUN_TEST(test_is_active);
+  RUN_TEST(test_relay);
+  RUN_TEST(test_leds);
+  RUN_TEST(test_out_of_range_event_ignored);
+  return UNITY_END();
+}
@@ -0,0 +1,238 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#include <unity.h>
+#include "FirmwareShim.h"
+#include "HostShim.h"
+#include "TokensFile.h"
+#include "TraceRecorder.hpp"
+
+static std::vector<TestToken> tokens;
+
+static const TestToken &token_with(bool access) {
+  for (const TestToken &token : tokens) {
+    if ((token.access > 0) == access) {
+      return token;
+    }
+  }
+  return tokens[0];
+}
+
+static uint32_t present(const TestToken &token) {
+  firmware_present(uid_hex(token).c_str());
+  firmware_run(10);
+  StaticJsonDocument<1024> auth;
+  TEST_ASSERT_TRUE(firmware_sent("token_auth", auth));
+  TEST_ASSERT_EQUAL_STRING(uid_hex(token).c_str(), auth["uid"].as<const char*>());
+  return auth["seq"];
+}
+
+static void reply(const TestToken &token, uint32_t seq, bool found, uint8_t access) {
+  StaticJsonDocument<256> info;
+  info["cmd"] = "token_info";
+  info["uid"] = uid_hex(token);
+  info["seq"] = seq;
+  info["found"] = found;
+  info["name"] = token.user;
+  info["access"] = access;
+  firmware_receive(info);
+}
+
+void setUp() {
+  firmware_reset();
+}
+
+void tearDown() {
+}
+
+void test_online_grant_expires() {
+  const TestToken &token = token_with(true);
+  uint32_t seq = present(token);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+
+  reply(token, seq, true, 1);
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  StaticJsonDocument<1024> state;
+  firmware_run(1000);
+  TEST_ASSERT_TRUE(firmware_sent("state_info", state));
+  TEST_ASSERT_EQUAL_STRING("online", state["auth"].as<const char*>());
+  TEST_ASSERT_EQUAL_STRING(token.user.c_str(), state["user"].as<const char*>());
+
+  firmware_run(4000);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+}
+
+void test_online_deny() {
+  const TestToken &token = token_with(true);
+  reply(token, present(token), true, 0);
+  firmware_run(10);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+  TEST_ASSERT_EQUAL(500, buzzer.beeps.back().ms);
+}
+
+void test_timeout_falls_back_to_database() {
+  const TestToken &granted = token_with(true);
+  present(granted);
+  firmware_run(1000);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  firmware_run(5000);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+
+  present(token_with(false));
+  firmware_run(1000);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+}
+
+// in offline-first mode the server still has the confirm timeout to
+// revoke a card, well after the query timeout has passed
+void test_offline_first_late_deny() {
+  firmware_reset("{\"offline_first\":true,\"card_unlock_time\":20000}");
+  const TestToken &token = token_with(true);
+  uint32_t seq = present(token);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  firmware_run(2000);
+  reply(token, seq, true, 0);
+  firmware_run(10);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+  TEST_ASSERT_EQUAL(500, buzzer.beeps.back().ms);
+}
+
+// and a deny after even that is acted on while the card is still in
+void test_offline_first_deny_after_confirm_timeout() {
+  firmware_reset("{\"offline_first\":true,\"card_unlock_time\":20000,\"token_confirm_timeout\":3000}");
+  const TestToken &token = token_with(true);
+  uint32_t seq = present(token);
+  firmware_run(4000);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  reply(token, seq, true, 0);
+  firmware_run(10);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+}
+
+static bool presented_beep(size_t from) {
+  return buzzer.beeps.size() > from && buzzer.beeps[from].ms == 100 && buzzer.beeps[from].hz == 500;
+}
+
+// every card is acknowledged when it is read, however it is then decided
+void test_presentation_beep() {
+  const TestToken &token = token_with(true);
+  uint32_t seq = present(token);
+  TEST_ASSERT_TRUE(presented_beep(0));
+
+  // read again while the lookup is pending
+  size_t beeps = buzzer.beeps.size();
+  firmware_present(uid_hex(token).c_str());
+  firmware_run(10);
+  TEST_ASSERT_TRUE(presented_beep(beeps));
+
+  // and again once the decision is cached
+  reply(token, seq, true, 1);
+  firmware_run(10);
+  beeps = buzzer.beeps.size();
+  firmware_present(uid_hex(token).c_str());
+  firmware_run(10);
+  TEST_ASSERT_TRUE(presented_beep(beeps));
+  TEST_ASSERT_EQUAL(1000, buzzer.beeps.back().hz);
+}
+
+void test_exit_button() {
+  host_set_input(FIRMWARE_EXIT_PIN, LOW);
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  host_set_input(FIRMWARE_EXIT_PIN, HIGH);
+  firmware_run(4900);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  firmware_run(200);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+}
+
+// on battery the modem skips beacons as well as sleeping between them
+void test_battery_wifi_sleep() {
+  TEST_ASSERT_EQUAL(WIFI_MODEM_SLEEP, WiFi.getSleepMode());
+  TEST_ASSERT_EQUAL(0, WiFi.getListenInterval());
+  firmware_set_voltage(12.0, true);
+  firmware_run(100);
+  TEST_ASSERT_EQUAL(WIFI_MODEM_SLEEP, WiFi.getSleepMode());
+  TEST_ASSERT_EQUAL(3, WiFi.getListenInterval());
+  firmware_set_voltage(14.6, true);
+  firmware_run(100);
+  TEST_ASSERT_EQUAL(0, WiFi.getListenInterval());
+}
+
+void test_remote_unlock() {
+  net.host_receive("{\"cmd\":\"state_set\",\"remote_active\":true}");
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_unlocked());
+  net.host_receive("{\"cmd\":\"state_set\",\"remote_active\":false}");
+  firmware_run(10);
+  TEST_ASSERT_FALSE(firmware_unlocked());
+}
+
+// the server's seq comes back as it was sent, whatever its type
+void test_token_update_seq() {
+  StaticJsonDocument<256> status;
+  net.host_receive("{\"cmd\":\"token_update\",\"uid\":\"04a1b2c3d4e5f6\",\"seq\":\"update-0001-of-0002\"}");
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_sent("token_update_status", status));
+  TEST_ASSERT_EQUAL_STRING("update-0001-of-0002", status["seq"] | "");
+  TEST_ASSERT_TRUE(status["applied"].as<bool>());
+
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"token_update\",\"uid\":\"04a1b2c3d4e5f6\",\"seq\":4000000000}");
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_sent("token_update_status", status));
+  TEST_ASSERT_EQUAL(4000000000UL, status["seq"].as<uint32_t>());
+
+  firmware_clear_sent();
+  net.host_receive("{\"cmd\":\"token_update\",\"uid\":\"04a1b2c3d4e5f6\",\"op\":\"remove\"}");
+  firmware_run(10);
+  TEST_ASSERT_TRUE(firmware_sent("token_update_status", status));
+  TEST_ASSERT_FALSE(status.containsKey("seq"));
+}
+
+void test_unknown_command() {
+  net.host_receive("{\"cmd\":\"no_such_command\"}");
+  firmware_run(10);
+  StaticJsonDocument<256> error;
+  TEST_ASSERT_TRUE(firmware_sent("error", error));
+  TEST_ASSERT_EQUAL_STRING("no_such_command", error["requested_cmd"].as<const char*>());
+}
+
+// a size too big for 16 bits is capped, not wrapped round
+void test_trace_start_size() {
+  net.host_receive("{\"cmd\":\"trace_start\",\"records\":65792}");
+  net.host_receive("{\"cmd\":\"trace_query\"}");
+  firmware_run(10);
+  StaticJsonDocument<1024> info;
+  TEST_ASSERT_TRUE(firmware_sent("trace_info", info));
+  TEST_ASSERT_EQUAL(TRACERECORDER_MAX_SIZE, info["capacity"].as<int>());
+  net.host_receive("{\"cmd\":\"trace_clear\"}");
+  firmware_run(10);
+}
+
+int main(int argc, char **argv) {
+  tokens = make_tokens(20, 1);
+  host_spiffs_format();
+  write_tokens_file("/tokens.dat", 4, tokens);
+  firmware_boot();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_online_grant_expires);
+  RUN_TEST(test_online_deny);
+  RUN_TEST(test_timeout_falls_back_to_database);
+  RUN_TEST(test_offline_first_late_deny);
+  RUN_TEST(test_offline_first_deny_after_confirm_timeout);
+  RUN_TEST(test_presentation_beep);
+  RUN_TEST(test_exit_button);
+  RUN_TEST(test_battery_wifi_sleep);
+  RUN_TEST(test_remote_unlock);
+  RUN_TEST(test_token_update_seq);
+  RUN_TEST(test_unknown_command);
+  RUN_TEST(test_trace_start_size);
+  return UNITY_END();
+}
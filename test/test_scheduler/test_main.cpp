@@ -0,0 +1,210 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+#include "HostShim.h"
+#include "Scheduler.hpp"
+
+static std::vector<int> ran;
+
+static void record(Scheduler &scheduler, uint8_t id) {
+  scheduler.set_callback(id, [id]() { ran.push_back(id); });
+}
+
+void setUp() {
+  host_set_millis(1000);
+  ran.clear();
+}
+
+void tearDown() {
+}
+
+void test_runs_in_deadline_order() {
+  Scheduler scheduler;
+  for (uint8_t id=0; id<5; id++) {
+    record(scheduler, id);
+  }
+  scheduler.after(0, 50);
+  scheduler.after(1, 10);
+  scheduler.after(2, 30);
+  scheduler.after(3, 20);
+  scheduler.after(4, 40);
+
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(0, ran.size());
+  host_advance_millis(35);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(3, ran.size());
+  TEST_ASSERT_EQUAL(1, ran[0]);
+  TEST_ASSERT_EQUAL(3, ran[1]);
+  TEST_ASSERT_EQUAL(2, ran[2]);
+  host_advance_millis(100);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(5, ran.size());
+  TEST_ASSERT_EQUAL(4, ran[3]);
+  TEST_ASSERT_EQUAL(0, ran[4]);
+}
+
+void test_due_exactly_on_deadline() {
+  Scheduler scheduler;
+  record(scheduler, 0);
+  scheduler.at(0, 1100);
+  host_set_millis(1099);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(0, ran.size());
+  host_set_millis(1100);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(1, ran.size());
+  TEST_ASSERT_FALSE(scheduler.is_pending(0));
+}
+
+void test_setting_again_moves_deadline() {
+  Scheduler scheduler;
+  record(scheduler, 0);
+  record(scheduler, 1);
+  scheduler.after(0, 10);
+  scheduler.after(1, 20);
+  scheduler.after(0, 30);
+  host_advance_millis(25);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(1, ran.size());
+  TEST_ASSERT_EQUAL(1, ran[0]);
+  TEST_ASSERT_TRUE(scheduler.is_pending(0));
+  host_advance_millis(5);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(2, ran.size());
+  TEST_ASSERT_EQUAL(0, ran[1]);
+}
+
+void test_cancel() {
+  Scheduler scheduler;
+  for (uint8_t id=0; id<4; id++) {
+    record(scheduler, id);
+    scheduler.after(id, 10 * (id + 1));
+  }
+  scheduler.cancel(1);
+  scheduler.cancel(1);
+  TEST_ASSERT_FALSE(scheduler.is_pending(1));
+  host_advance_millis(100);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(3, ran.size());
+  TEST_ASSERT_EQUAL(0, ran[0]);
+  TEST_ASSERT_EQUAL(2, ran[1]);
+  TEST_ASSERT_EQUAL(3, ran[2]);
+}
+
+void test_next_due() {
+  Scheduler scheduler;
+  TEST_ASSERT_EQUAL(0xFFFFFFFF, scheduler.next_due());
+  scheduler.after(3, 40);
+  scheduler.after(2, 15);
+  TEST_ASSERT_EQUAL(15, scheduler.next_due());
+  host_advance_millis(20);
+  TEST_ASSERT_EQUAL(0, scheduler.next_due());
+}
+
+void test_out_of_range_ids_ignored() {
+  Scheduler scheduler;
+  scheduler.after(SCHEDULER_SIZE, 10);
+  TEST_ASSERT_FALSE(scheduler.is_pending(SCHEDULER_SIZE));
+  TEST_ASSERT_EQUAL(0xFFFFFFFF, scheduler.next_due());
+}
+
+void test_every_slot() {
+  Scheduler scheduler;
+  for (uint8_t id=0; id<SCHEDULER_SIZE; id++) {
+    record(scheduler, id);
+    scheduler.after(id, SCHEDULER_SIZE - id);
+  }
+  host_advance_millis(SCHEDULER_SIZE);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(SCHEDULER_SIZE, ran.size());
+  for (uint8_t i=0; i<SCHEDULER_SIZE; i++) {
+    TEST_ASSERT_EQUAL(SCHEDULER_SIZE - 1 - i, ran[i]);
+  }
+}
+
+// a periodic task runs once per pass, not until it catches up
+void test_self_rescheduling() {
+  Scheduler scheduler;
+  int runs = 0;
+  scheduler.set_callback(0, [&]() {
+    runs++;
+    scheduler.after(0, 10);
+  });
+  scheduler.after(0, 10);
+  for (int i=0; i<100; i++) {
+    host_advance_millis(1);
+    scheduler.loop();
+  }
+  TEST_ASSERT_EQUAL(10, runs);
+  host_advance_millis(1000);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(11, runs);
+}
+
+// the unlock expiry pattern: a deadline extended after the task was
+// scheduled pushes the task back instead of expiring early
+void test_extended_deadline() {
+  Scheduler scheduler;
+  unsigned long until = millis() + 100;
+  bool expired = false;
+  scheduler.set_callback(0, [&]() {
+    if ((long)(until - millis()) > 0) {
+      scheduler.at(0, until);
+      return;
+    }
+    expired = true;
+  });
+  scheduler.at(0, until);
+  host_advance_millis(60);
+  until = millis() + 100;
+  host_advance_millis(40);
+  scheduler.loop();
+  TEST_ASSERT_FALSE(expired);
+  TEST_ASSERT_TRUE(scheduler.is_pending(0));
+  host_advance_millis(59);
+  scheduler.loop();
+  TEST_ASSERT_FALSE(expired);
+  host_advance_millis(1);
+  scheduler.loop();
+  TEST_ASSERT_TRUE(expired);
+}
+
+// deadlines either side of millis() wrapping around still run in order
+void test_wraparound() {
+  Scheduler scheduler;
+  record(scheduler, 0);
+  record(scheduler, 1);
+  host_set_millis((unsigned long)-20);
+  scheduler.after(1, 30);
+  scheduler.after(0, 10);
+  TEST_ASSERT_EQUAL(10, scheduler.next_due());
+  host_advance_millis(15);
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(1, ran.size());
+  TEST_ASSERT_EQUAL(0, ran[0]);
+  host_advance_millis(15);
+  TEST_ASSERT_EQUAL(10, millis());
+  scheduler.loop();
+  TEST_ASSERT_EQUAL(2, ran.size());
+  TEST_ASSERT_EQUAL(1, ran[1]);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_runs_in_deadline_order);
+  RUN_TEST(test_due_exactly_on_deadline);
+  RUN_TEST(test_setting_again_moves_deadline);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_next_due);
+  RUN_TEST(test_out_of_range_ids_ignored);
+  RUN_TEST(test_every_slot);
+  RUN_TEST(test_self_rescheduling);
+  RUN_TEST(test_extended_deadline);
+  RUN_TEST(test_wraparound);
+  return UNITY_END();
+}
@@ -0,0 +1,168 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <Arduino.h>
+#include <FS.h>
+#include <unity.h>
+#include "HostShim.h"
+#include "TokensFile.h"
+#include "recordreader.hpp"
+#include "tokendb.hpp"
+
+#define TOKENS "/tokens.dat"
+#define JOURNAL "/tokens.jnl"
+
+static std::vector<TestToken> tokens;
+static std::vector<TestToken> absent;
+
+void setUp() {
+  SPIFFS.format();
+}
+
+void tearDown() {
+}
+
+static void check_lookups(int version, bool hashed, size_t index_bytes) {
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENS, version, tokens, hashed));
+  TokenDB db(TOKENS, JOURNAL);
+  db.set_index_max_bytes(index_bytes);
+
+  for (const TestToken &token : tokens) {
+    std::string uid = uid_hex(token);
+    bool found = db.lookup(uid.c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(token.access > 0, found, uid.c_str());
+    if (found && version != 1) {
+      TEST_ASSERT_EQUAL_STRING(token.user.c_str(), db.get_user().c_str());
+    }
+  }
+  for (const TestToken &token : absent) {
+    TEST_ASSERT_FALSE(db.lookup(uid_hex(token).c_str()));
+  }
+}
+
+void test_v1() {
+  check_lookups(1, false, 0);
+  check_lookups(1, false, 8192);
+}
+
+void test_v2() {
+  check_lookups(2, false, 0);
+  check_lookups(2, false, 8192);
+}
+
+void test_v3() {
+  check_lookups(3, false, 0);
+  check_lookups(3, false, 8192);
+}
+
+void test_v4() {
+  check_lookups(4, false, 0);
+}
+
+void test_v4_hashed() {
+  check_lookups(4, true, 0);
+}
+
+void test_missing_file() {
+  TokenDB db(TOKENS, JOURNAL);
+  TEST_ASSERT_FALSE(db.lookup(uid_hex(tokens[1]).c_str()));
+  TEST_ASSERT_EQUAL(-1, db.get_version());
+}
+
+void test_journal_overrides_file() {
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENS, 4, tokens));
+  TokenDB db(TOKENS, JOURNAL);
+  std::string granted = uid_hex(tokens[1]);
+  std::string added = uid_hex(absent[0]);
+
+  TEST_ASSERT_TRUE(db.update(granted.c_str(), true, 0, ""));
+  TEST_ASSERT_TRUE(db.update(added.c_str(), false, 1, "added"));
+  TEST_ASSERT_FALSE(db.lookup(granted.c_str()));
+  TEST_ASSERT_TRUE(db.lookup(added.c_str()));
+  TEST_ASSERT_EQUAL_STRING("added", db.get_user().c_str());
+}
+
+void test_compaction() {
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENS, 4, tokens));
+  TokenDB db(TOKENS, JOURNAL);
+  db.set_journal_max_bytes(1);
+  std::string removed = uid_hex(tokens[1]);
+  std::string added = uid_hex(absent[0]);
+  TEST_ASSERT_TRUE(db.update(removed.c_str(), true, 0, ""));
+  TEST_ASSERT_TRUE(db.update(added.c_str(), false, 1, "added"));
+
+  for (int i=0; i<1000 && SPIFFS.exists(JOURNAL); i++) {
+    db.loop();
+  }
+  TEST_ASSERT_FALSE(SPIFFS.exists(JOURNAL));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TOKENDB_COMPACT_FILENAME));
+  TEST_ASSERT_FALSE(db.lookup(removed.c_str()));
+  TEST_ASSERT_TRUE(db.lookup(added.c_str()));
+  TEST_ASSERT_EQUAL(tokens.size(), db.get_record_count());
+}
+
+// a reset between removing tokens.dat and renaming the new file
+void test_recover_compacted_file() {
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENDB_COMPACT_DONE_FILENAME, 4, tokens));
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENDB_COMPACT_FILENAME, 4, absent));
+  TokenDB db(TOKENS, JOURNAL);
+  TEST_ASSERT_TRUE(db.lookup(uid_hex(tokens[1]).c_str()));
+  TEST_ASSERT_TRUE(SPIFFS.exists(TOKENS));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TOKENDB_COMPACT_DONE_FILENAME));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TOKENDB_COMPACT_FILENAME));
+}
+
+// a reset before the old file was removed keeps the old file
+void test_recover_keeps_existing_file() {
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENS, 4, tokens));
+  TEST_ASSERT_TRUE(write_tokens_file(TOKENDB_COMPACT_DONE_FILENAME, 4, absent));
+  TokenDB db(TOKENS, JOURNAL);
+  TEST_ASSERT_TRUE(db.lookup(uid_hex(tokens[1]).c_str()));
+  TEST_ASSERT_FALSE(db.lookup(uid_hex(absent[1]).c_str()));
+  TEST_ASSERT_FALSE(SPIFFS.exists(TOKENDB_COMPACT_DONE_FILENAME));
+}
+
+// Skipping past the buffer in a forward scan keeps filling whole buffers,
+// rather than falling back to the block at a time a random seek reads.
+void test_reader_skip_stays_sequential() {
+  File file = SPIFFS.open("/records", "w");
+  for (int i=0; i<RECORDREADER_BUFFER_SIZE * 10; i++) {
+    file.write((uint8_t)i);
+  }
+  file.close();
+
+  RecordReader reader;
+  file = SPIFFS.open("/records", "r");
+  reader.begin(file);
+  uint32_t offset = 0;
+  while (reader.available()) {
+    TEST_ASSERT_EQUAL((uint8_t)offset, reader.read());
+    reader.skip(9);
+    offset += 10;
+  }
+  reader.end();
+  TEST_ASSERT_EQUAL(RECORDREADER_BUFFER_SIZE * 10, offset);
+  // a buffer at a time, and one more to find the end
+  TEST_ASSERT_EQUAL(11, reader.read_calls);
+  TEST_ASSERT_EQUAL(RECORDREADER_BUFFER_SIZE * 10, reader.read_bytes);
+}
+
+int main(int argc, char **argv) {
+  tokens = make_tokens(500, 1);
+  absent = make_absent_tokens(100, 2);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_v1);
+  RUN_TEST(test_v2);
+  RUN_TEST(test_v3);
+  RUN_TEST(test_v4);
+  RUN_TEST(test_v4_hashed);
+  RUN_TEST(test_missing_file);
+  RUN_TEST(test_journal_overrides_file);
+  RUN_TEST(test_compaction);
+  RUN_TEST(test_recover_compacted_file);
+  RUN_TEST(test_recover_keeps_existing_file);
+  RUN_TEST(test_reader_skip_stays_sequential);
+  return UNITY_END();
+}
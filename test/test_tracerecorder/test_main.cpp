@@ -0,0 +1,150 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <Arduino.h>
+#include <unity.h>
+#include "DoorMachine.hpp"
+#include "HostShim.h"
+#include "TraceRecorder.hpp"
+
+static TraceRecorder trace;
+
+static TraceRecord last() {
+  TraceRecord record;
+  trace.read(trace.size() - 1, &record, 1);
+  return record;
+}
+
+static uint16_t centivolts(const TraceRecord &record) {
+  return record.data[0] | (record.data[1] << 8);
+}
+
+void setUp() {
+  host_set_millis(1000);
+  trace.clear();
+}
+
+void tearDown() {
+}
+
+void test_idle_until_started() {
+  trace.input(trace_exit_press);
+  trace.voltage(12.0);
+  TEST_ASSERT_FALSE(trace.is_recording());
+  TEST_ASSERT_EQUAL(0, trace.size());
+}
+
+void test_records_in_order() {
+  TEST_ASSERT_TRUE(trace.start(8));
+  host_advance_millis(5);
+  trace.input(trace_exit_press);
+  uint8_t uid[] = {0x04, 0x11, 0x22, 0x33};
+  trace.token(uid, sizeof(uid));
+  trace.command(0x12345678);
+
+  TraceRecord records[4];
+  TEST_ASSERT_EQUAL(4, trace.read(0, records, 4));
+  TEST_ASSERT_EQUAL(trace_start, records[0].type);
+  TEST_ASSERT_EQUAL(1000, records[0].time);
+  TEST_ASSERT_EQUAL(trace_input, records[1].type);
+  TEST_ASSERT_EQUAL(1005, records[1].time);
+  TEST_ASSERT_EQUAL(trace_exit_press, records[1].data[0]);
+  TEST_ASSERT_EQUAL(trace_token, records[2].type);
+  TEST_ASSERT_EQUAL(4, records[2].len);
+  TEST_ASSERT_EQUAL(0x33, records[2].data[3]);
+  TEST_ASSERT_EQUAL(trace_command, records[3].type);
+  TEST_ASSERT_EQUAL(0x78, records[3].data[0]);
+  TEST_ASSERT_EQUAL(0x12, records[3].data[3]);
+}
+
+void test_overwrites_oldest() {
+  trace.start(4);
+  for (int i=0; i<6; i++) {
+    trace.input((trace_input_t)i);
+  }
+  TEST_ASSERT_EQUAL(4, trace.size());
+  TEST_ASSERT_EQUAL(3, trace.overwritten);
+  TraceRecord records[4];
+  trace.read(0, records, 4);
+  for (int i=0; i<4; i++) {
+    TEST_ASSERT_EQUAL(i + 2, records[i].data[0]);
+  }
+}
+
+void test_stop_keeps_trace() {
+  trace.start(4);
+  trace.stop();
+  trace.input(trace_door_open);
+  TEST_ASSERT_FALSE(trace.is_recording());
+  TEST_ASSERT_EQUAL(1, trace.size());
+}
+
+void test_voltage_only_on_change() {
+  trace.start(16);
+  trace.voltage(13.20);
+  TEST_ASSERT_EQUAL(2, trace.size());
+  TEST_ASSERT_EQUAL(1320, centivolts(last()));
+  trace.voltage(13.25);
+  trace.voltage(13.11);
+  TEST_ASSERT_EQUAL(2, trace.size());
+  trace.voltage(13.10);
+  TEST_ASSERT_EQUAL(3, trace.size());
+  TEST_ASSERT_EQUAL(1310, centivolts(last()));
+  // measured from the last recorded sample, so a slow drift is still seen
+  trace.voltage(13.05);
+  trace.voltage(13.01);
+  trace.voltage(13.00);
+  TEST_ASSERT_EQUAL(4, trace.size());
+  TEST_ASSERT_EQUAL(1300, centivolts(last()));
+}
+
+void test_voltage_after_power_change() {
+  trace.start(16);
+  trace.voltage(13.20);
+  trace.power(true);
+  TEST_ASSERT_EQUAL(trace_power, last().type);
+  TEST_ASSERT_EQUAL(1, last().data[0]);
+  trace.voltage(13.18);
+  TEST_ASSERT_EQUAL(trace_voltage, last().type);
+  TEST_ASSERT_EQUAL(1318, centivolts(last()));
+  trace.voltage(13.17);
+  TEST_ASSERT_EQUAL(4, trace.size());
+  trace.power(false);
+  TEST_ASSERT_EQUAL(0, last().data[0]);
+}
+
+void test_restart_records_first_voltage() {
+  trace.start(16);
+  trace.voltage(13.20);
+  trace.start(16);
+  trace.voltage(13.20);
+  TEST_ASSERT_EQUAL(2, trace.size());
+  TEST_ASSERT_EQUAL(trace_voltage, last().type);
+}
+
+// a day-long remote unlock doesn't fit in 16 bits of seconds
+void test_snapshot_remaining() {
+  trace.start(16);
+  unsigned long remaining[4] = {4500, 0, 1800000, 86400000};
+  trace.snapshot(DOOR_CARD | DOOR_SNIB | DOOR_REMOTE, 0, remaining);
+  TraceRecord record = last();
+  TEST_ASSERT_EQUAL(trace_snapshot, record.type);
+  TEST_ASSERT_EQUAL(5000, TraceRecorder::snapshot_remaining(record, 0));
+  TEST_ASSERT_EQUAL(0, TraceRecorder::snapshot_remaining(record, 1));
+  TEST_ASSERT_EQUAL(1800000, TraceRecorder::snapshot_remaining(record, 2));
+  TEST_ASSERT_EQUAL(86400000, TraceRecorder::snapshot_remaining(record, 3));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_idle_until_started);
+  RUN_TEST(test_records_in_order);
+  RUN_TEST(test_overwrites_oldest);
+  RUN_TEST(test_stop_keeps_trace);
+  RUN_TEST(test_voltage_only_on_change);
+  RUN_TEST(test_voltage_after_power_change);
+  RUN_TEST(test_restart_records_first_voltage);
+  RUN_TEST(test_snapshot_remaining);
+  return UNITY_END();
+}
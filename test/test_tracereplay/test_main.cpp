@@ -0,0 +1,363 @@
+// SPDX-FileCopyrightText: 2024 Tim Hawes
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <Arduino.h>
+#include <unity.h>
+#include <base64.hpp>
+#include <initializer_list>
+#include "FirmwareShim.h"
+#include "HostShim.h"
+#include "TokensFile.h"
+#include "TraceRecorder.hpp"
+#include "TraceReplay.h"
+
+// main.cpp's
+extern DoorMachine door;
+
+#define UID 0x04, 0x01, 0x02, 0x03
+
+static TraceRecord make(uint32_t time, uint8_t type, std::initializer_list<uint8_t> data) {
+  TraceRecord record;
+  record.time = time;
+  record.type = type;
+  record.len = data.size();
+  memset(record.data, 0, sizeof(record.data));
+  if (data.size() > 0) {
+    memcpy(record.data, data.begin(), data.size());
+  }
+  return record;
+}
+
+static TraceRecord token_info(uint32_t time, uint8_t seq, uint8_t flags, uint8_t access) {
+  return make(time, trace_token_info, {seq, 0, 0, 0, flags, access});
+}
+
+// a card presented and its lookup sent, as token_present records them
+static void present(std::vector<TraceRecord> &records, uint32_t time, uint8_t seq) {
+  records.push_back(make(time, trace_token, {UID}));
+  records.push_back(make(time, trace_token_auth, {seq, 0, 0, 0}));
+}
+
+static void assert_output(const TraceOutput &output, uint32_t time, uint8_t active, DoorMachine::led_t led) {
+  TEST_ASSERT_EQUAL(time, output.time);
+  TEST_ASSERT_EQUAL(active, output.active);
+  TEST_ASSERT_EQUAL(active != 0, output.relay);
+  TEST_ASSERT_EQUAL(led, output.led);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_exit_press_expires() {
+  TraceReplayer replayer;
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1200, trace_input, {trace_exit_press}),
+    make(1300, trace_input, {trace_exit_release}),
+  });
+  replayer.finish(10000);
+  TEST_ASSERT_EQUAL(3, replayer.outputs.size());
+  assert_output(replayer.outputs[0], 1000, 0, DoorMachine::led_on);
+  assert_output(replayer.outputs[1], 1200, DOOR_EXIT, DoorMachine::led_flash_fast);
+  assert_output(replayer.outputs[2], 6200, 0, DoorMachine::led_on);
+}
+
+void test_expiry_between_records() {
+  TraceReplayer replayer("{\"card_unlock_time\":3000}");
+  std::vector<TraceRecord> records = { make(1000, trace_start, {}) };
+  present(records, 1500, 7);
+  records.push_back(token_info(1550, 7, TRACE_FOUND, 1));
+  records.push_back(make(1600, trace_input, {trace_exit_press}));
+  records.push_back(make(1700, trace_input, {trace_exit_release}));
+  records.push_back(make(20000, trace_input, {trace_door_close}));
+  replayer.replay(records);
+  TEST_ASSERT_EQUAL(5, replayer.outputs.size());
+  assert_output(replayer.outputs[1], 1550, DOOR_CARD, DoorMachine::led_flash_fast);
+  assert_output(replayer.outputs[2], 1600, DOOR_CARD | DOOR_EXIT, DoorMachine::led_flash_fast);
+  assert_output(replayer.outputs[3], 4550, DOOR_EXIT, DoorMachine::led_flash_fast);
+  assert_output(replayer.outputs[4], 6600, 0, DoorMachine::led_on);
+}
+
+void test_denied() {
+  TraceReplayer replayer;
+  std::vector<TraceRecord> records = { make(1000, trace_start, {}) };
+  present(records, 1100, 1);
+  records.push_back(token_info(1200, 1, TRACE_FOUND, 0));
+  replayer.replay(records);
+  replayer.finish(5000);
+  TEST_ASSERT_EQUAL(1, replayer.outputs.size());
+  TEST_ASSERT_EQUAL(500, buzzer.beeps.back().ms);
+}
+
+// the firmware times the lookup out for itself and finds the card in the
+// tokens.dat made from the local_grant record
+void test_timeout_falls_back_to_database() {
+  TraceReplayer replayer;
+  std::vector<TraceRecord> records = { make(1000, trace_start, {}) };
+  present(records, 1100, 3);
+  records.push_back(token_info(2100, 3, TRACE_TIMEOUT, 0));
+  records.push_back(make(2100, trace_local_grant, {3, 0, 0, 0, trace_database}));
+  replayer.replay(records);
+  replayer.finish(3000);
+  TEST_ASSERT_EQUAL(2, replayer.outputs.size());
+  assert_output(replayer.outputs[1], 2100, DOOR_CARD, DoorMachine::led_flash_fast);
+}
+
+void test_cached_grant() {
+  TraceReplayer replayer;
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1100, trace_token, {UID}),
+    make(1100, trace_local_grant, {0, 0, 0, 0, trace_cached}),
+  });
+  TEST_ASSERT_EQUAL(2, replayer.outputs.size());
+  assert_output(replayer.outputs[1], 1100, DOOR_CARD, DoorMachine::led_flash_fast);
+}
+
+void test_card_disabled() {
+  TraceReplayer replayer;
+  std::vector<TraceRecord> records = {
+    make(1000, trace_start, {}),
+    make(1100, trace_state_set, {1 << trace_card_enable, 0}),
+  };
+  present(records, 1200, 1);
+  records.push_back(token_info(1300, 1, TRACE_FOUND, 1));
+  replayer.replay(records);
+  TEST_ASSERT_EQUAL(0, replayer.get_active());
+}
+
+void test_provisional_revoke() {
+  TraceReplayer replayer("{\"offline_first\":true}");
+  std::vector<TraceRecord> records = { make(1000, trace_start, {}) };
+  present(records, 1100, 5);
+  records.push_back(make(1100, trace_local_grant, {5, 0, 0, 0, trace_database}));
+  records.push_back(token_info(1400, 5, TRACE_FOUND | TRACE_PROVISIONAL, 0));
+  replayer.replay(records);
+  TEST_ASSERT_EQUAL(3, replayer.outputs.size());
+  assert_output(replayer.outputs[1], 1100, DOOR_CARD, DoorMachine::led_flash_fast);
+  assert_output(replayer.outputs[2], 1400, 0, DoorMachine::led_on);
+}
+
+void test_state_set() {
+  TraceReplayer replayer;
+  uint8_t remote = 1 << trace_remote_active;
+  uint8_t snib = 1 << trace_snib_active;
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1100, trace_state_set, {(uint8_t)(remote | snib), remote}),
+    make(1200, trace_state_set, {remote, 0}),
+    make(1300, trace_state_set, {1 << trace_exit_enable, 0}),
+    make(1400, trace_input, {trace_exit_press}),
+  });
+  TEST_ASSERT_EQUAL(3, replayer.outputs.size());
+  assert_output(replayer.outputs[1], 1100, DOOR_REMOTE, DoorMachine::led_flash_medium);
+  assert_output(replayer.outputs[2], 1200, 0, DoorMachine::led_on);
+}
+
+void test_snib_renew() {
+  TraceReplayer replayer("{\"snib_unlock_time\":10000}");
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1000, trace_input, {trace_snib_press}),
+    make(1100, trace_input, {trace_snib_release}),
+    make(9000, trace_state_set, {1 << trace_snib_renew, 1 << trace_snib_renew}),
+  });
+  replayer.finish(18999);
+  TEST_ASSERT_EQUAL(DOOR_SNIB, replayer.get_active());
+  replayer.finish(19000);
+  TEST_ASSERT_EQUAL(0, replayer.get_active());
+}
+
+void test_snapshot() {
+  TraceReplayer replayer;
+  uint8_t flags = (1 << trace_card_enable) | (1 << trace_snib_enable) | TRACE_ON_BATTERY;
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1000, trace_snapshot, {DOOR_SNIB, flags, 0, 0, 0, 0, 60, 0, 0, 0}),
+    make(2000, trace_input, {trace_exit_press}),
+  });
+  assert_output(replayer.outputs.back(), 1000, DOOR_SNIB, DoorMachine::led_flash_medium);
+  TEST_ASSERT_EQUAL(DOOR_SNIB, replayer.get_active());
+  replayer.finish(100000);
+  assert_output(replayer.outputs.back(), 61000, 0, DoorMachine::led_dim);
+}
+
+// a day-long remote unlock is recorded in minutes
+void test_snapshot_remote_day() {
+  TraceReplayer replayer;
+  uint8_t flags = (1 << trace_card_enable) | (1 << trace_exit_enable) | (1 << trace_snib_enable);
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1000, trace_snapshot, {DOOR_REMOTE, flags, 0, 0, 0, 0, 0, 0, 0xa0, 0x85}),
+  });
+  replayer.finish(86400999);
+  TEST_ASSERT_EQUAL(DOOR_REMOTE, replayer.get_active());
+  replayer.finish(86401000);
+  TEST_ASSERT_EQUAL(0, replayer.get_active());
+}
+
+void test_battery() {
+  TraceReplayer replayer;
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1100, trace_voltage, {0x10, 0x05}),
+    make(1100, trace_power, {1}),
+  });
+  assert_output(replayer.outputs.back(), 1100, 0, DoorMachine::led_dim);
+  replayer.replay({
+    make(1200, trace_input, {trace_snib_press}),
+    make(1250, trace_input, {trace_snib_release}),
+  });
+  TEST_ASSERT_EQUAL(0, replayer.get_active());
+  replayer.replay({
+    make(1300, trace_voltage, {0x78, 0x05}),
+    make(1300, trace_power, {0}),
+    make(1400, trace_input, {trace_snib_press}),
+  });
+  TEST_ASSERT_EQUAL(DOOR_SNIB, replayer.get_active());
+}
+
+// the firmware makes the long press itself from the button being held
+void test_hold_exit_for_snib() {
+  TraceReplayer replayer("{\"hold_exit_for_snib\":true,\"anti_bounce\":true}");
+  replayer.replay({
+    make(1000, trace_start, {}),
+    make(1100, trace_input, {trace_exit_press}),
+    make(2100, trace_input, {trace_exit_longpress}),
+    make(2200, trace_input, {trace_exit_release}),
+    make(6200, trace_input, {trace_door_open}),
+  });
+  TEST_ASSERT_EQUAL(DOOR_SNIB, replayer.get_active());
+  // holding exit for the snib ends the exit unlock
+  assert_output(replayer.outputs[2], 2100, DOOR_SNIB, DoorMachine::led_flash_medium);
+  replayer.replay({
+    make(7000, trace_input, {trace_exit_press}),
+    make(8000, trace_input, {trace_exit_longpress}),
+    make(8100, trace_input, {trace_exit_release}),
+  });
+  assert_output(replayer.outputs.back(), 8000, 0, DoorMachine::led_on);
+}
+
+static std::vector<TraceOutput> live;
+
+static void live_run(unsigned long ms) {
+  unsigned long end = millis() + ms;
+  while ((long)(millis() - end) < 0) {
+    unsigned long time = firmware_step(end - millis());
+    TraceOutput out = { (uint32_t)time, door.get_active(), firmware_unlocked(),
+                        door.led(false, true) };
+    if (live.empty() || live.back().active != out.active || live.back().relay != out.relay
+        || live.back().led != out.led) {
+      live.push_back(out);
+    }
+  }
+}
+
+static void live_send(const char *json) {
+  StaticJsonDocument<256> obj;
+  deserializeJson(obj, json);
+  firmware_receive(obj);
+}
+
+static uint32_t live_present(const TestToken &token) {
+  firmware_present(uid_hex(token).c_str());
+  live_run(1);
+  StaticJsonDocument<1024> auth;
+  firmware_sent("token_auth", auth);
+  return auth["seq"];
+}
+
+// A trace the firmware makes of itself, pulled with trace_query as the
+// server would, replays to the same outputs the firmware gave at the time.
+void test_recorded_trace() {
+  std::vector<TestToken> tokens = make_tokens(2, 3);
+  tokens[0].access = 1;
+  tokens[1].access = 1;
+  TEST_ASSERT_TRUE(write_tokens_file("/tokens.dat", 4, {tokens[1]}));
+  firmware_reset();
+
+  live.clear();
+  live_send("{\"cmd\":\"trace_start\",\"records\":64}");
+  live_run(250);
+  uint32_t seq = live_present(tokens[0]);
+  live_run(80);
+  StaticJsonDocument<256> info;
+  info["cmd"] = "token_info";
+  info["uid"] = uid_hex(tokens[0]);
+  info["seq"] = seq;
+  info["found"] = true;
+  info["access"] = 1;
+  firmware_receive(info);
+  live_run(6000);
+  host_set_input(FIRMWARE_EXIT_PIN, LOW);
+  live_run(300);
+  host_set_input(FIRMWARE_EXIT_PIN, HIGH);
+  live_run(6000);
+  // no reply, so it falls back to tokens.dat
+  live_present(tokens[1]);
+  live_run(7000);
+  live_send("{\"cmd\":\"state_set\",\"remote_active\":true}");
+  live_run(2000);
+  live_send("{\"cmd\":\"state_set\",\"remote_active\":false}");
+  live_run(1000);
+  live_send("{\"cmd\":\"trace_stop\"}");
+  live_run(1);
+  uint32_t end = millis();
+
+  std::vector<TraceRecord> records;
+  size_t count;
+  do {
+    firmware_clear_sent();
+    char query[64];
+    snprintf(query, sizeof(query), "{\"cmd\":\"trace_query\",\"offset\":%u}", (unsigned)records.size());
+    live_send(query);
+    live_run(1);
+    DynamicJsonDocument reply(4096);
+    TEST_ASSERT_TRUE(firmware_sent("trace_info", reply));
+    std::string data = reply["data"].as<const char*>();
+    std::vector<uint8_t> bytes(data.size());
+    size_t len = decode_base64((unsigned char*)&data[0], bytes.data());
+    count = TraceReplayer::parse(bytes.data(), len, records);
+    TEST_ASSERT_EQUAL(reply["count"].as<int>(), count);
+  } while (count > 0);
+  TEST_ASSERT_EQUAL(trace_start, records[0].type);
+
+  TraceReplayer replayer;
+  replayer.replay(records);
+  replayer.finish(end);
+  TEST_ASSERT_EQUAL(0, replayer.unknown);
+  TEST_ASSERT_EQUAL(live.size(), replayer.outputs.size());
+  for (size_t i=0; i<live.size(); i++) {
+    TEST_ASSERT_EQUAL(live[i].time, replayer.outputs[i].time);
+    TEST_ASSERT_EQUAL(live[i].active, replayer.outputs[i].active);
+    TEST_ASSERT_EQUAL(live[i].relay, replayer.outputs[i].relay);
+    TEST_ASSERT_EQUAL(live[i].led, replayer.outputs[i].led);
+  }
+  TEST_ASSERT_EQUAL(9, live.size());
+}
+
+int main(int argc, char **argv) {
+  host_spiffs_format();
+  firmware_boot();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_exit_press_expires);
+  RUN_TEST(test_expiry_between_records);
+  RUN_TEST(test_denied);
+  RUN_TEST(test_timeout_falls_back_to_database);
+  RUN_TEST(test_cached_grant);
+  RUN_TEST(test_card_disabled);
+  RUN_TEST(test_provisional_revoke);
+  RUN_TEST(test_state_set);
+  RUN_TEST(test_snib_renew);
+  RUN_TEST(test_snapshot);
+  RUN_TEST(test_snapshot_remote_day);
+  RUN_TEST(test_battery);
+  RUN_TEST(test_hold_exit_for_snib);
+  RUN_TEST(test_recorded_trace);
+  return UNITY_END();
+}